@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2010 by Blake Foster <blfoster@vassar.edu>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef ICMPFLOOD_H
+#define ICMPFLOOD_H
+
+#include "ICMPPingScheduler.h"
+#include "ICMPPingStats.h"
+
+
+struct ICMPFloodResult
+{
+    /*
+    What ICMPFlood achieved.
+    @param sent: The number of echo requests made, including any that the
+    W5100 couldn't send.
+    @param received: The number of them that were answered.
+    @param elapsed: The time from the first request going out to the last
+    one being answered or timing out, in ms.
+    @param bytes: The number of payload bytes that came back.
+    */
+    uint32_t sent;
+    uint32_t received;
+    uint32_t elapsed;
+    uint32_t bytes;
+
+    uint32_t lost() const { return sent - received; }
+
+    /*
+    @return: Replies per second.
+    */
+    float packetsPerSecond() const { return elapsed ? received * 1000.0 / elapsed : 0; }
+
+    /*
+    @return: Payload bytes per second that made it there and back.
+    */
+    float goodput() const { return elapsed ? bytes * 1000.0 / elapsed : 0; }
+};
+
+
+template <uint16_t PayloadSize>
+class ICMPFloodT : public ICMPPingSchedulerT<PayloadSize>
+{
+    /*
+    Function-object for loading a link with echo requests to one host, like
+    ping -l or ping -f, to see how much it can take. Keeps a window of up to
+    ICMPPING_MAX_PENDING requests in flight, and sends the next one as soon
+    as one is answered or times out, so the rate settles at whatever the
+    host, the link, and the W5100 can manage. A bigger payload, e.g.
+    ICMPFloodT<1024>, gets more bytes through per request. Only flood
+    hosts and networks that you're responsible for.
+    */
+
+public:
+    /*
+    Construct a flood object.
+    @param socket: The socket number in the W5100.
+    @param id: The id to put in the ping packets. Can be pretty much any
+    arbitrary number.
+    */
+    ICMPFloodT(SOCKET s, uint16_t id);
+
+    // the ping versions are still available.
+    using ICMPPingT<PayloadSize>::operator();
+
+    /*
+    Sends count echo requests to addr, with up to window in flight at once,
+    and blocks until they've all been answered or timed out. There are no
+    retries; a request that times out is lost. Requests go no faster than
+    the pacer, if there is one, lets them.
+    @param addr: IP address to flood.
+    @param count: Number of requests to send.
+    @param window: Number of requests to keep in flight, at most
+    ICMPPING_MAX_PENDING.
+    @param result: Filled in with the counts and rates achieved.
+    @param stats: Optional; every result is added to it, for the RTTs.
+    @param timeout: Optional timeout estimator for addr; see
+    ICMPTimeoutEstimator. If NULL, ICMPPing::timeout() is used.
+    */
+    void operator()(const IPAddress& addr, uint32_t count, uint16_t window, ICMPFloodResult& result,
+                    ICMPPingStats * stats = NULL, ICMPTimeoutEstimator * timeout = NULL);
+
+private:
+
+    // counts the results as they come in.
+    static void countResult(uint16_t tag, const ICMPEchoReplyT<PayloadSize>& result, void * context);
+
+    ICMPFloodResult * _result;
+    ICMPPingStats * _stats;
+};
+
+typedef ICMPFloodT<REQ_DATASIZE> ICMPFlood;
+
+#include "ICMPFloodImpl.h"
+
+#endif
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2010 by Blake Foster <blfoster@vassar.edu>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Implementation of the templates declared in ICMPFlood.h.
+ */
+
+#ifndef ICMPFLOODIMPL_H
+#define ICMPFLOODIMPL_H
+
+
+template <uint16_t PayloadSize>
+ICMPFloodT<PayloadSize>::ICMPFloodT(SOCKET socket, uint16_t id) :
+  ICMPPingSchedulerT<PayloadSize>(socket, id), _result(NULL), _stats(NULL)
+{
+}
+
+template <uint16_t PayloadSize>
+void ICMPFloodT<PayloadSize>::countResult(uint16_t tag, const ICMPEchoReplyT<PayloadSize>& result,
+                                          void * context)
+{
+    ICMPFloodT<PayloadSize> * self = (ICMPFloodT<PayloadSize> *)context;
+    if (result.status == SUCCESS)
+    {
+        ++self->_result->received;
+        self->_result->bytes += PayloadSize;
+    }
+    ++self->_result->sent;
+    if (self->_stats)
+        self->_stats->add(result);
+    (void)tag;
+}
+
+template <uint16_t PayloadSize>
+void ICMPFloodT<PayloadSize>::operator()(const IPAddress& addr, uint32_t count, uint16_t window,
+                                         ICMPFloodResult& result, ICMPPingStats * stats,
+                                         ICMPTimeoutEstimator * timeout)
+{
+    memset(&result, 0, sizeof(result));
+    _result = &result;
+    _stats = stats;
+    this->setCallback(countResult, this);
+
+    if (window < 1)
+        window = 1;
+    if (window > ICMPPING_MAX_PENDING)
+        window = ICMPPING_MAX_PENDING;
+
+    icmp_time_t start = millis();
+    uint32_t added = 0;
+    while (added < count || this->pending() > 0)
+    {
+        // top the window back up as requests finish.
+        while (added < count && this->pending() < window && this->add(addr, 0, 1, timeout))
+            ++added;
+
+        this->poll();
+        ICMPPING_DOYIELD();
+    }
+    result.elapsed = millis() - start;
+
+    this->setCallback(NULL);
+    _result = NULL;
+    _stats = NULL;
+}
+
+#endif
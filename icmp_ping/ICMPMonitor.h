@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2010 by Blake Foster <blfoster@vassar.edu>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef ICMPMONITOR_H
+#define ICMPMONITOR_H
+
+#include "ICMPPingScheduler.h"
+
+
+typedef enum ICMPMonitorState
+{
+    /*
+    What ICMPMonitor makes of a host.
+    */
+    HOST_UNKNOWN = 0, // not enough results yet
+    HOST_UP = 1,
+    HOST_DOWN = 2
+} ICMPMonitorState;
+
+
+struct ICMPMonitorTarget
+{
+    /*
+    One host watched by an ICMPMonitor, as filled in by ICMPMonitor::watch().
+    @param addr: The address being pinged.
+    @param interval: The time between probes while the host isn't down, in
+    ms. Zero if the slot is free.
+    @param nextProbe: The millis() time at which the next probe is due.
+    @param changed: The millis() time at which state last changed.
+    @param rtt: The round trip time of the last reply, in the units of
+    ICMPEchoReply::rtt.
+    @param history: The results of the last 16 probes, newest in bit 0: set
+    if it was answered.
+    @param results: How many of the bits in history are real results.
+    @param backoff: How many times interval has been doubled since the host
+    went down.
+    @param state: An ICMPMonitorState.
+    @param probing: Whether a probe is in flight.
+    */
+    IPAddress addr;
+    uint32_t interval;
+    uint32_t nextProbe;
+    uint32_t changed;
+    icmp_time_t rtt;
+    uint16_t history;
+    uint8_t results;
+    uint8_t backoff;
+    uint8_t state;
+    bool probing;
+};
+
+
+template <uint16_t PayloadSize>
+class ICMPMonitorT : public ICMPPingSchedulerT<PayloadSize>
+{
+    /*
+    Keeps track of whether each of a list of hosts is up or down, by pinging
+    each one every so often in the background of a cooperative main loop.
+
+    The targets live in an array of ICMPMonitorTargets that the caller
+    provides, so the number of them is fixed up front, at about 28 bytes of
+    RAM apiece. Add hosts with watch(), and call poll() every time around
+    loop(). Each host is probed on its own interval, shifted by a random
+    amount (see setJitter()) so that hosts added together don't stay in
+    lockstep and send their probes in bursts. A host only changes state when
+    n of its last m probes agree (see setHysteresis()), so one lost ping
+    doesn't make it flap. While a host is down its interval doubles after
+    every unanswered probe, up to a limit (see setMaxBackoff()), so that
+    dead hosts don't take up the slots that live ones need; the first reply
+    puts it straight back to normal.
+
+    The socket is opened and closed around each burst of probes unless
+    begin() was called; call it if the probes are close together.
+
+       void printChange(uint16_t index, const ICMPMonitorTarget& target, void * context)
+       {
+           ...
+       }
+
+       ICMPMonitorTarget targets[10];
+       ICMPMonitor monitor(0, (uint16_t)random(0, 255), targets, 10);
+
+       void setup()
+       {
+           ...
+           monitor.setChangeCallback(printChange);
+           monitor.watch(someAddr, 5000);
+           monitor.begin();
+       }
+
+       void loop()
+       {
+           monitor.poll();
+           doSomeStuff();
+       }
+    */
+
+public:
+    /*
+    Called whenever a host changes state.
+    @param index: The host's index in the array of targets, as returned by
+    watch().
+    @param target: The host, with its new state.
+    @param context: Whatever was passed to setChangeCallback().
+    */
+    typedef void (*ChangeCallback)(uint16_t index, const ICMPMonitorTarget& target, void * context);
+
+    /*
+    Construct a monitor.
+    @param socket: The socket number in the W5100.
+    @param id: The id to put in the ping packets. Can be pretty much any
+    arbitrary number.
+    @param targets: Somewhere to keep the hosts being watched.
+    @param capacity: The number of ICMPMonitorTargets in targets.
+    */
+    ICMPMonitorT(SOCKET s, uint16_t id, ICMPMonitorTarget * targets, uint16_t capacity);
+
+    // the ping versions are still available.
+    using ICMPPingT<PayloadSize>::operator();
+
+    /*
+    Set the function to call when a host changes state.
+    */
+    void setChangeCallback(ChangeCallback callback, void * context = NULL);
+
+    /*
+    A host that isn't down goes down once n of its last m probes have gone
+    unanswered, and a host that's down comes back up once n of its last m
+    probes have been answered. An unknown host comes up at the first reply.
+    The default is 3 of 5.
+    @param m: At most 16.
+    */
+    void setHysteresis(uint8_t n, uint8_t m);
+
+    /*
+    Probes are sent at a random time within percent of a host's interval
+    either side of when they're due. The default is 10.
+    */
+    void setJitter(uint8_t percent);
+
+    /*
+    A host that's down has its interval doubled at most doublings times.
+    The default is 4, i.e. up to 16 times as long.
+    */
+    void setMaxBackoff(uint8_t doublings);
+
+    /*
+    Start watching a host. Its first probe is sent at a random time within
+    its first interval.
+    @param addr: IP address to watch.
+    @param interval: Time between probes, in ms.
+    @return: The index of its slot in the targets, or -1 if there isn't a
+    free one.
+    */
+    int32_t watch(const IPAddress& addr, uint32_t interval);
+
+    /*
+    Stop watching the host at index. Its slot is free again once any probe
+    in flight has finished.
+    */
+    void unwatch(uint16_t index);
+
+    const ICMPMonitorTarget& operator[](uint16_t index) const { return _targets[index]; }
+    uint16_t capacity() const { return _capacity; }
+
+    /*
+    Sends any probes that are due, and moves the ones in flight along. Call
+    this as often as possible.
+    @return: The number of probes in flight.
+    */
+    uint16_t poll();
+
+private:
+
+    // counts the result against its host.
+    static void probeResult(uint16_t tag, const ICMPEchoReplyT<PayloadSize>& result, void * context);
+
+    // when the next probe is due, interval from now, give or take the jitter.
+    uint32_t nextProbe(uint32_t interval);
+    // a number from 0 to n - 1 (xorshift, so there's no need for random()).
+    uint32_t randomBelow(uint32_t n);
+
+    ICMPMonitorTarget * _targets;
+    uint16_t _capacity;
+    uint16_t _cursor; // where poll() starts looking for probes that are due
+    uint32_t _seed;
+    uint8_t _n;
+    uint8_t _m;
+    uint8_t _jitter;
+    uint8_t _maxBackoff;
+
+    ChangeCallback _changeCallback;
+    void * _changeContext;
+};
+
+typedef ICMPMonitorT<REQ_DATASIZE> ICMPMonitor;
+
+#include "ICMPMonitorImpl.h"
+
+#endif
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2010 by Blake Foster <blfoster@vassar.edu>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Implementation of the templates declared in ICMPMonitor.h.
+ */
+
+#ifndef ICMPMONITORIMPL_H
+#define ICMPMONITORIMPL_H
+
+
+template <uint16_t PayloadSize>
+ICMPMonitorT<PayloadSize>::ICMPMonitorT(SOCKET socket, uint16_t id, ICMPMonitorTarget * targets,
+                                        uint16_t capacity) :
+  ICMPPingSchedulerT<PayloadSize>(socket, id), _targets(targets), _capacity(capacity), _cursor(0),
+  _n(3), _m(5), _jitter(10), _maxBackoff(4), _changeCallback(NULL), _changeContext(NULL)
+{
+    // not memset(), since IPAddress may be a class with a vtable.
+    for (uint16_t i = 0; i < _capacity; ++i)
+    {
+        _targets[i].interval = 0;
+        _targets[i].probing = false;
+    }
+    // different monitors (or boards) shouldn't jitter the same way.
+    _seed = ((uint32_t)id << 24) ^ micros();
+    if (_seed == 0)
+        _seed = 1;
+    this->setCallback(probeResult, this);
+}
+
+template <uint16_t PayloadSize>
+void ICMPMonitorT<PayloadSize>::setChangeCallback(ChangeCallback callback, void * context)
+{
+    _changeCallback = callback;
+    _changeContext = context;
+}
+
+template <uint16_t PayloadSize>
+void ICMPMonitorT<PayloadSize>::setHysteresis(uint8_t n, uint8_t m)
+{
+    _m = m < 1 ? 1 : (m > 16 ? 16 : m);
+    _n = n < 1 ? 1 : (n > _m ? _m : n);
+}
+
+template <uint16_t PayloadSize>
+void ICMPMonitorT<PayloadSize>::setJitter(uint8_t percent)
+{
+    _jitter = percent > 100 ? 100 : percent;
+}
+
+template <uint16_t PayloadSize>
+void ICMPMonitorT<PayloadSize>::setMaxBackoff(uint8_t doublings)
+{
+    _maxBackoff = doublings;
+}
+
+template <uint16_t PayloadSize>
+uint32_t ICMPMonitorT<PayloadSize>::randomBelow(uint32_t n)
+{
+    _seed ^= _seed << 13;
+    _seed ^= _seed >> 17;
+    _seed ^= _seed << 5;
+    return n ? _seed % n : 0;
+}
+
+template <uint16_t PayloadSize>
+uint32_t ICMPMonitorT<PayloadSize>::nextProbe(uint32_t interval)
+{
+    // percent either side, without overflowing for long intervals.
+    uint32_t spread = interval / 100 * _jitter + interval % 100 * _jitter / 100;
+    return millis() + interval - spread + randomBelow(2 * spread + 1);
+}
+
+template <uint16_t PayloadSize>
+int32_t ICMPMonitorT<PayloadSize>::watch(const IPAddress& addr, uint32_t interval)
+{
+    if (interval == 0)
+        interval = 1;
+    for (uint16_t i = 0; i < _capacity; ++i)
+    {
+        ICMPMonitorTarget& target = _targets[i];
+        if (target.interval != 0 || target.probing)
+            continue;
+
+        target.addr = addr;
+        target.interval = interval;
+        target.nextProbe = millis() + randomBelow(interval);
+        target.changed = millis();
+        target.rtt = 0;
+        target.history = 0;
+        target.results = 0;
+        target.backoff = 0;
+        target.state = HOST_UNKNOWN;
+        return i;
+    }
+    return -1;
+}
+
+template <uint16_t PayloadSize>
+void ICMPMonitorT<PayloadSize>::unwatch(uint16_t index)
+{
+    if (index < _capacity)
+        _targets[index].interval = 0;
+}
+
+template <uint16_t PayloadSize>
+void ICMPMonitorT<PayloadSize>::probeResult(uint16_t tag, const ICMPEchoReplyT<PayloadSize>& result,
+                                            void * context)
+{
+    ICMPMonitorT<PayloadSize> * self = (ICMPMonitorT<PayloadSize> *)context;
+    ICMPMonitorTarget& target = self->_targets[tag];
+    target.probing = false;
+    if (target.interval == 0)
+        return; // unwatched while the probe was out.
+
+    bool answered = result.status == SUCCESS;
+    target.history = (target.history << 1) | answered;
+    if (target.results < 16)
+        ++target.results;
+    if (answered)
+        target.rtt = result.rtt;
+
+    // count the answers among the last m (or as many as we have).
+    uint8_t m = target.results < self->_m ? target.results : self->_m;
+    uint8_t answers = 0;
+    for (uint8_t i = 0; i < m; ++i)
+        answers += (target.history >> i) & 1;
+
+    uint8_t state = target.state;
+    if (state != HOST_UP && answers >= (state == HOST_UNKNOWN ? 1 : self->_n))
+        state = HOST_UP;
+    else if (state != HOST_DOWN && m - answers >= self->_n)
+        state = HOST_DOWN;
+
+    // back off while it's down, but probe at the normal rate as soon as it
+    // answers, so that it can come back up quickly.
+    if (answered)
+        target.backoff = 0;
+    else if (state == HOST_DOWN && target.state == HOST_DOWN && target.backoff < self->_maxBackoff)
+        ++target.backoff;
+
+    uint32_t interval = target.interval;
+    for (uint8_t i = 0; i < target.backoff && interval < 0x20000000UL; ++i)
+        interval <<= 1;
+    target.nextProbe = self->nextProbe(interval);
+
+    if (state != target.state)
+    {
+        target.state = state;
+        target.changed = millis();
+        if (self->_changeCallback)
+            self->_changeCallback(tag, target, self->_changeContext);
+    }
+}
+
+template <uint16_t PayloadSize>
+uint16_t ICMPMonitorT<PayloadSize>::poll()
+{
+    // queue whatever's due, starting where we left off last time so that
+    // the hosts near the start of the table don't get first pick of the
+    // slots every time.
+    uint32_t now = millis();
+    for (uint16_t n = 0; n < _capacity; ++n)
+    {
+        uint16_t i = _cursor;
+        ICMPMonitorTarget& target = _targets[i];
+        if (target.interval != 0 && !target.probing && (int32_t)(now - target.nextProbe) >= 0)
+        {
+            // no retries; the hysteresis takes care of the odd lost ping.
+            if (!this->add(target.addr, i, 1))
+                break;
+            target.probing = true;
+        }
+        _cursor = _cursor + 1 < _capacity ? _cursor + 1 : 0;
+    }
+    return ICMPPingSchedulerT<PayloadSize>::poll();
+}
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2010 by Blake Foster <blfoster@vassar.edu>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef ICMPMULTIPING_H
+#define ICMPMULTIPING_H
+
+#include "ICMPPingScheduler.h"
+
+
+template <uint16_t PayloadSize>
+class ICMPMultiPingT : public ICMPPingSchedulerT<PayloadSize>
+{
+    /*
+    Function-object for pinging many hosts at once.
+
+    Echo requests go out back-to-back to up to ICMPPING_MAX_PENDING hosts, and
+    replies are matched to their request by source address, id and sequence
+    number as they come in. As soon as a host replies or times out its slot
+    goes to the next address in the list, so a sweep of N dead hosts costs
+    about N / ICMPPING_MAX_PENDING timeouts rather than N. This is just an
+    ICMPPingScheduler that blocks until the whole list is done.
+    */
+
+public:
+    /*
+    Called once for each address that operator() was asked to ping.
+    @param index: The position of the address in the array passed to operator().
+    @param result: The result of pinging that address. Only valid for the
+    duration of the call.
+    @param context: Whatever was passed to operator() along with the callback.
+    */
+    typedef typename ICMPPingSchedulerT<PayloadSize>::Callback Callback;
+
+    /*
+    Construct a multi-target ping object.
+    @param socket: The socket number in the W5100.
+    @param id: The id to put in the ping packets. Can be pretty much any
+    arbitrary number.
+    */
+    ICMPMultiPingT(SOCKET s, uint16_t id);
+
+    // the single-target versions are still available.
+    using ICMPPingT<PayloadSize>::operator();
+
+    /*
+    Pings every address in addrs, and blocks until all of them have either
+    replied or run out of retries.
+    @param addrs: Array of IP addresses to ping.
+    @param count: Number of addresses in addrs.
+    @param nRetries: Number of times to try each address before giving up.
+    @param callback: Called once per address with the result.
+    @param context: Passed through to callback untouched.
+    @param timeouts: Optional array of count timeout estimators, one per
+    address, to decide how long to wait for each host and learn from its
+    replies. If NULL, every host gets ICMPPing::timeout().
+    @return: The number of addresses that replied.
+    */
+    uint16_t operator()(const IPAddress * addrs, uint16_t count, int nRetries,
+                        Callback callback, void * context = NULL,
+                        ICMPTimeoutEstimator * timeouts = NULL);
+
+private:
+
+    // counts the replies on their way to the caller's callback.
+    static void countResult(uint16_t index, const ICMPEchoReplyT<PayloadSize>& result, void * context);
+
+    Callback _userCallback;
+    void * _userContext;
+    uint16_t _numReplied;
+};
+
+
+template <uint16_t PayloadSize>
+class ICMPPingPoolT : public ICMPMultiPingT<PayloadSize>
+{
+    /*
+    An ICMPMultiPing that spreads its requests across its own socket plus
+    every other socket that's idle when a sweep starts, so that several
+    requests can be waiting on ARP or sitting in the W5100's TX buffers at the
+    same time. The extra sockets are closed again, and so free for the
+    Ethernet library, when operator() returns.
+
+    Only blocking sweeps are supported: add() and poll() are hidden, since a
+    scheduler that always had something pending would keep every idle socket
+    from EthernetClient and EthernetUDP for good. Use an ICMPPingScheduler,
+    which only ever uses its own socket, to ping without blocking.
+    */
+
+public:
+    /*
+    Construct a socket pool.
+    @param socket: The socket number in the W5100. This one is always used,
+    and is the only one used for single-target pings.
+    @param id: The id to put in the ping packets. Can be pretty much any
+    arbitrary number.
+    */
+    ICMPPingPoolT(SOCKET s, uint16_t id);
+
+protected:
+
+    virtual void openSockets();
+
+private:
+
+    using ICMPMultiPingT<PayloadSize>::add;
+    using ICMPMultiPingT<PayloadSize>::poll;
+};
+
+typedef ICMPMultiPingT<REQ_DATASIZE> ICMPMultiPing;
+typedef ICMPMultiPing::Callback ICMPMultiPingCallback;
+typedef ICMPPingPoolT<REQ_DATASIZE> ICMPPingPool;
+
+#include "ICMPMultiPingImpl.h"
+
+#endif
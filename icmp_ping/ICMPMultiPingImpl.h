@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2010 by Blake Foster <blfoster@vassar.edu>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Implementation of the templates declared in ICMPMultiPing.h.
+ */
+
+#ifndef ICMPMULTIPINGIMPL_H
+#define ICMPMULTIPINGIMPL_H
+
+
+template <uint16_t PayloadSize>
+ICMPMultiPingT<PayloadSize>::ICMPMultiPingT(SOCKET socket, uint16_t id) :
+  ICMPPingSchedulerT<PayloadSize>(socket, id), _userCallback(NULL), _userContext(NULL), _numReplied(0)
+{
+}
+
+template <uint16_t PayloadSize>
+void ICMPMultiPingT<PayloadSize>::countResult(uint16_t index, const ICMPEchoReplyT<PayloadSize>& result,
+                                              void * context)
+{
+    ICMPMultiPingT<PayloadSize> * self = (ICMPMultiPingT<PayloadSize> *)context;
+    if (result.status == SUCCESS)
+        ++self->_numReplied;
+    if (self->_userCallback)
+        self->_userCallback(index, result, self->_userContext);
+}
+
+template <uint16_t PayloadSize>
+uint16_t ICMPMultiPingT<PayloadSize>::operator()(const IPAddress * addrs, uint16_t count, int nRetries,
+                                                 Callback callback, void * context,
+                                                 ICMPTimeoutEstimator * timeouts)
+{
+    _userCallback = callback;
+    _userContext = context;
+    _numReplied = 0;
+    this->setCallback(countResult, this);
+
+    uint16_t next = 0;
+    while (next < count || this->pending() > 0)
+    {
+        // hand any free slots to the next addresses in the list.
+        while (next < count && this->add(addrs[next], next, nRetries, timeouts ? &timeouts[next] : NULL))
+            ++next;
+
+        this->poll();
+        ICMPPING_DOYIELD();
+    }
+
+    this->setCallback(NULL);
+    return _numReplied;
+}
+
+
+template <uint16_t PayloadSize>
+ICMPPingPoolT<PayloadSize>::ICMPPingPoolT(SOCKET socket, uint16_t id) :
+  ICMPMultiPingT<PayloadSize>(socket, id)
+{
+}
+
+template <uint16_t PayloadSize>
+void ICMPPingPoolT<PayloadSize>::openSockets()
+{
+    ICMPPingSchedulerT<PayloadSize>::openSockets();
+
+    // claim every other socket that the Ethernet library isn't using.
+    for (SOCKET s = 0; s < MAX_SOCK_NUM; ++s)
+    {
+        if (s == this->_socket || !ICMPPingChip::socketClosed(s))
+            continue;
+        this->openSocket(s);
+        this->_sockets[this->_numSockets++] = s;
+    }
+}
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2010 by Blake Foster <blfoster@vassar.edu>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+#include "ICMPPacer.h"
+
+ICMPPacer::ICMPPacer(uint16_t rate, uint8_t burst, uint16_t minInterval) :
+  _minInterval(minInterval), _numHosts(0)
+{
+    setRate(rate, burst);
+}
+
+void ICMPPacer::setRate(uint16_t rate, uint8_t burst)
+{
+    _rate = rate;
+    _burst = burst ? burst : 1;
+    _tokens = _burst * 1000UL;
+    _lastRefill = millis();
+}
+
+void ICMPPacer::setMinInterval(uint16_t minInterval)
+{
+    _minInterval = minInterval;
+}
+
+int8_t ICMPPacer::findHost(const IPAddress& addr) const
+{
+    for (uint8_t i = 0; i < _numHosts; ++i)
+    {
+        if (addr == _hosts[i].addr)
+            return i;
+    }
+    return -1;
+}
+
+bool ICMPPacer::take(const IPAddress& addr)
+{
+    icmp_time_t now = millis();
+
+    if (_rate)
+    {
+        // rate tokens a second is rate thousandths a ms. The bucket always
+        // holds at least a ms worth, or rates over 1000 a second would be
+        // cut down to one request per tick of millis().
+        uint32_t full = _burst * 1000UL;
+        if (full < _rate)
+            full = _rate;
+        icmp_time_t elapsed = now - _lastRefill;
+        _lastRefill = now;
+        // compare before multiplying, so that a long quiet spell can't
+        // overflow.
+        if (elapsed > (full - _tokens) / _rate)
+            _tokens = full;
+        else
+            _tokens += elapsed * _rate;
+
+        if (_tokens < 1000)
+            return false;
+    }
+
+    int8_t host = -1;
+    if (_minInterval)
+    {
+        host = findHost(addr);
+        if (host >= 0 && now - _hosts[host].sent < _minInterval)
+            return false;
+
+        if (host < 0)
+        {
+            // make room by forgetting whoever we sent to longest ago.
+            if (_numHosts < ICMPPING_PACER_HOSTS)
+            {
+                host = _numHosts++;
+            }
+            else
+            {
+                host = 0;
+                for (uint8_t i = 1; i < _numHosts; ++i)
+                {
+                    if (now - _hosts[i].sent > now - _hosts[host].sent)
+                        host = i;
+                }
+            }
+            for (uint8_t i = 0; i < 4; ++i)
+                _hosts[host].addr[i] = addr[i];
+        }
+        _hosts[host].sent = now;
+    }
+
+    if (_rate)
+        _tokens -= 1000;
+    return true;
+}
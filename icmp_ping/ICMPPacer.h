@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2010 by Blake Foster <blfoster@vassar.edu>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef ICMPPACER_H
+#define ICMPPACER_H
+
+#include "ICMPPing.h"
+
+// ICMPPING_PACER_HOSTS -- the number of destinations an ICMPPacer remembers
+// sending to, for its minimum interval. Each costs 8 bytes of RAM. When it's
+// full, the one sent to longest ago is forgotten.
+#ifndef ICMPPING_PACER_HOSTS
+#define ICMPPING_PACER_HOSTS 8
+#endif
+
+
+class ICMPPacer
+{
+    /*
+    Keeps echo requests from going out faster than the network can take
+    them. A token bucket limits the overall rate to some number of requests
+    per second, with bursts of up to some number at once, and there's a
+    minimum interval between requests to the same destination, so that
+    retries and back-to-back sweeps don't trip anyone's ICMP rate limits.
+    Give one to ICMPPing::setPacer(); ICMPPingScheduler and ICMPMultiPing
+    hold requests in their queue until it lets them go, and plain pings
+    wait for it.
+    */
+
+public:
+    /*
+    @param rate: Requests per second, or 0 for no limit.
+    @param burst: The most requests that can go out at once after a quiet
+    spell. Since the bucket is refilled once a ms, at rates over 1000 a
+    second it's at least rate / 1000.
+    @param minInterval: The least time between two requests to the same
+    destination, in ms, or 0 for no limit.
+    */
+    ICMPPacer(uint16_t rate = 0, uint8_t burst = 1, uint16_t minInterval = 0);
+
+    void setRate(uint16_t rate, uint8_t burst = 1);
+    void setMinInterval(uint16_t minInterval);
+
+    /*
+    Ask to send a request to addr.
+    @return: true if it can go now, in which case it's counted against the
+    limits, or false if it has to wait.
+    */
+    bool take(const IPAddress& addr);
+
+private:
+
+    // the index of addr in _hosts, or -1.
+    int8_t findHost(const IPAddress& addr) const;
+
+    uint16_t _rate;
+    uint8_t _burst;
+    uint16_t _minInterval;
+
+    // in thousandths of a request, so that the bucket can be refilled
+    // every ms even at low rates.
+    uint32_t _tokens;
+    icmp_time_t _lastRefill;
+
+    struct Host
+    {
+        uint8_t addr[4];
+        icmp_time_t sent;
+    };
+    Host _hosts[ICMPPING_PACER_HOSTS];
+    uint8_t _numHosts;
+};
+
+#endif
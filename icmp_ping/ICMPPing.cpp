@@ -8,374 +8,626 @@
  */
 
 #include "ICMPPing.h"
-#include <util.h>
+#include "ICMPPacer.h"
 
-#ifdef ICMPPING_INSERT_YIELDS
-#define ICMPPING_DOYIELD()		delay(2)
-#else
-#define ICMPPING_DOYIELD()
+// on a PC (SSE2, or NEON), sum in the machine's own byte order, in a loop
+// the compiler can spread across vector registers.
+#if defined(__SSE2__) || defined(__ARM_NEON)
+#define ICMPPING_WIDE_SUM
 #endif
 
 
-inline uint16_t _makeUint16(const uint8_t& highOrder, const uint8_t& lowOrder)
+uint16_t _onesSum(uint8_t const * data, uint16_t len)
 {
-    // make a 16-bit unsigned integer given the low order and high order bytes.
-    // lowOrder first because the Arduino is little endian.
-    uint8_t value [] = {lowOrder, highOrder};
-    return *(uint16_t *)&value;
+    uint16_t i = 0;
+#ifdef ICMPPING_WIDE_SUM
+    // 32-bit words added up in 64 bits, so nothing carries out. The byte
+    // order doesn't matter to a ones complement sum, as long as the result
+    // is swapped back to big endian at the end (RFC 1071, section 2).
+    uint64_t wide = 0;
+    for (; i + 4 <= len; i += 4)
+    {
+        uint32_t word;
+        memcpy(&word, data + i, sizeof(word));
+        wide += word;
+    }
+    wide = (wide >> 32) + (wide & 0xFFFFFFFF);
+    wide = (wide >> 32) + (wide & 0xFFFFFFFF);
+    unsigned long sum = _foldSum(wide);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    sum = (uint16_t)((sum << 8) | (sum >> 8));
+#endif
+#else
+    // 32-bit accumulation (up to 32K words can't overflow it), four words
+    // to a pass to cut down on loop overhead.
+    unsigned long sum = 0;
+    for (; i + 8 <= len; i += 8)
+    {
+        sum += _makeUint16(data[i], data[i + 1]);
+        sum += _makeUint16(data[i + 2], data[i + 3]);
+        sum += _makeUint16(data[i + 4], data[i + 5]);
+        sum += _makeUint16(data[i + 6], data[i + 7]);
+    }
+#endif
+    for (; i + 1 < len; i += 2)
+    {
+        sum += _makeUint16(data[i], data[i + 1]);
+    }
+    if (len & 1)
+    {
+        // odd length, so pad the last byte with a zero.
+        sum += _makeUint16(data[len - 1], 0);
+    }
+    return _foldSum(sum);
 }
 
-uint16_t _checksum(const ICMPEcho& echo)
+uint16_t _checksum(const ICMPHeader& icmpHeader, uint16_t id, uint16_t seq,
+                   icmp_time_t time, uint16_t payloadSum)
 {
-    // calculate the checksum of an ICMPEcho with all fields but icmpHeader.checksum populated
-    unsigned long sum = 0;
+    // calculate the checksum of an ICMP echo packet with all fields but
+    // icmpHeader.checksum populated, given the ones complement sum of its
+    // payload. Since the sum is associative (RFC 1071, RFC 1624) the
+    // payload's part of it doesn't have to be recomputed every time the
+    // header changes.
+    unsigned long sum = payloadSum;
 
-    // add the header, bytes reversed since we're using little-endian arithmetic.
-    sum += _makeUint16(echo.icmpHeader.type, echo.icmpHeader.code);
+    // add the header
+    sum += _makeUint16(icmpHeader.type, icmpHeader.code);
 
     // add id and sequence
-    sum += echo.id + echo.seq;
+    sum += id;
+    sum += seq;
 
     // add time, one half at a time.
-    uint16_t const * time = (uint16_t const *)&echo.time;
-    sum += *time + *(time + 1);
-    
-    // add the payload
-    for (uint8_t const * b = echo.payload; b < echo.payload + sizeof(echo.payload); b+=2)
-    {
-        sum += _makeUint16(*b, *(b + 1));
-    }
+    sum += (uint16_t)(time >> 16);
+    sum += (uint16_t)time;
 
     // ones complement of ones complement sum
-    sum = (sum >> 16) + (sum & 0xffff);
-    sum += (sum >> 16);
-    return ~sum;
+    return ~_foldSum(sum);
 }
 
-ICMPEcho::ICMPEcho(uint8_t type, uint16_t _id, uint16_t _seq, uint8_t * _payload)
-: seq(_seq), id(_id), time(millis())
+
+ICMPTimeoutEstimator::ICMPTimeoutEstimator(uint16_t initialTimeout)
 {
-    memcpy(payload, _payload, REQ_DATASIZE);
-    icmpHeader.type = type;
-    icmpHeader.code = 0;
-    icmpHeader.checksum = _checksum(*this);
+    reset(initialTimeout);
 }
 
-ICMPEcho::ICMPEcho()
-: seq(0), id(0), time(0)
+void ICMPTimeoutEstimator::reset(uint16_t initialTimeout)
 {
-    memset(payload, 0, sizeof(payload));
-    icmpHeader.code = 0;
-    icmpHeader.type = 0;
-    icmpHeader.checksum = 0;
+    _srtt = 0;
+    _rttvar = 0;
+    _rto = initialTimeout * ICMPPING_RTT_PER_MS;
 }
 
-void ICMPEcho::serialize(uint8_t * binData) const
+icmp_time_t ICMPTimeoutEstimator::timeout() const
 {
-    *(binData++) = icmpHeader.type;
-    *(binData++) = icmpHeader.code;
-
-    *(uint16_t *)binData = htons(icmpHeader.checksum); binData += 2;
-    *(uint16_t *)binData = htons(id);                  binData += 2;
-    *(uint16_t *)binData = htons(seq);                 binData += 2;
-    *(icmp_time_t *)  binData = htonl(time);                binData += 4;
-
-    memcpy(binData, payload, sizeof(payload));
+    return _rto ? _rto : ICMPPingBase::timeout() * ICMPPING_RTT_PER_MS;
 }
 
-void ICMPEcho::deserialize(uint8_t const * binData)
+void ICMPTimeoutEstimator::addSample(icmp_time_t rtt)
 {
-    icmpHeader.type = *(binData++);
-    icmpHeader.code = *(binData++);
-
-    icmpHeader.checksum = ntohs(*(uint16_t *)binData); binData += 2;
-    id                  = ntohs(*(uint16_t *)binData); binData += 2;
-    seq                 = ntohs(*(uint16_t *)binData); binData += 2;
-
-    if (icmpHeader.type != TIME_EXCEEDED)
+    if (_srtt == 0)
     {
-        time = ntohl(*(icmp_time_t *)binData);   binData += 4;
+        // RFC 6298 section 2.2: SRTT = R, RTTVAR = R / 2. The +1 keeps a
+        // zero RTT from looking like no RTT at all.
+        _srtt = (rtt << 3) + 1;
+        _rttvar = rtt << 1;
+    }
+    else
+    {
+        // section 2.3: RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, then
+        // SRTT = 7/8 SRTT + 1/8 R, in the scaled form.
+        icmp_time_t srtt = _srtt >> 3;
+        icmp_time_t err = rtt > srtt ? rtt - srtt : srtt - rtt;
+        _rttvar += err - (_rttvar >> 2);
+        _srtt += rtt - srtt;
     }
 
-    memcpy(payload, binData, sizeof(payload));
+    // RTO = SRTT + max(G, 4 RTTVAR), where the clock granularity G is one
+    // tick.
+    _rto = (_srtt >> 3) + (_rttvar ? _rttvar : 1);
+    if (_rto < ICMPPING_MIN_TIMEOUT * ICMPPING_RTT_PER_MS)
+        _rto = ICMPPING_MIN_TIMEOUT * ICMPPING_RTT_PER_MS;
+    if (_rto > ICMPPING_MAX_TIMEOUT * ICMPPING_RTT_PER_MS)
+        _rto = ICMPPING_MAX_TIMEOUT * ICMPPING_RTT_PER_MS;
 }
 
+void ICMPTimeoutEstimator::backoff()
+{
+    // section 5.5.
+    _rto <<= 1;
+    if (_rto > ICMPPING_MAX_TIMEOUT * ICMPPING_RTT_PER_MS)
+        _rto = ICMPPING_MAX_TIMEOUT * ICMPPING_RTT_PER_MS;
+}
 
-uint16_t ICMPPing::ping_timeout = PING_TIMEOUT;
 
-ICMPPing::ICMPPing(SOCKET socket, uint8_t id) :
-#ifdef ICMPPING_ASYNCH_ENABLE
-  _curSeq(0), _numRetries(0), _asyncstart(0), _asyncstatus(BAD_RESPONSE),
-#endif
-  _id(id), _nextSeq(0), _socket(socket),  _attempt(0)
+ICMPSequenceWindow::ICMPSequenceWindow()
 {
-    memset(_payload, 0x1A, REQ_DATASIZE);
+    reset();
 }
 
-
-void ICMPPing::setPayload(uint8_t * payload)
+void ICMPSequenceWindow::reset()
 {
-	memcpy(_payload, payload, REQ_DATASIZE);
+    _seen = 0;
+    _highest = 0;
+    _received = 0;
+    _reordered = 0;
+    _duplicates = 0;
 }
 
-void ICMPPing::openSocket()
+ICMPSequenceOrder ICMPSequenceWindow::add(uint16_t seq)
 {
+    // how far ahead of the highest so far, modulo 2^16.
+    int16_t ahead = (int16_t)(seq - _highest);
+    if (_seen == 0 || ahead > 0)
+    {
+        // the first reply always counts as new, wherever it falls.
+        if (_seen == 0 || ahead >= 32)
+            _seen = 1;
+        else
+            _seen = (_seen << ahead) | 1;
+        _highest = seq;
+        ++_received;
+        return SEQ_NEW;
+    }
 
-	W5100.execCmdSn(_socket, Sock_CLOSE);
-    W5100.writeSnIR(_socket, 0xFF);
-    W5100.writeSnMR(_socket, SnMR::IPRAW);
-    W5100.writeSnPROTO(_socket, IPPROTO::ICMP);
-    W5100.writeSnPORT(_socket, 0);
-    W5100.execCmdSn(_socket, Sock_OPEN);
+    uint16_t behind = -ahead;
+    if (behind >= 32)
+    {
+        ++_duplicates;
+        return SEQ_TOO_OLD;
+    }
+    uint32_t bit = (uint32_t)1 << behind;
+    if (_seen & bit)
+    {
+        ++_duplicates;
+        return SEQ_DUPLICATE;
+    }
+    _seen |= bit;
+    ++_received;
+    ++_reordered;
+    return SEQ_REORDERED;
 }
 
 
-
-void ICMPPing::operator()(const IPAddress& addr, int nRetries, ICMPEchoReply& result)
+ICMPReplyDispatcher::ICMPReplyDispatcher() :
+  _late(0), _strays(0), _lateCallback(NULL), _lateContext(NULL)
 {
-	openSocket();
+    memset(_requests, 0, sizeof(_requests));
+    for (uint8_t i = 0; i < ICMPPING_MAILBOX; ++i)
+    {
+        _mailbox[i].request = NO_REQUEST;
+    }
+}
 
-    ICMPEcho echoReq(ICMP_ECHOREQ, _id, _nextSeq++, _payload);
+void ICMPReplyDispatcher::setLateCallback(LateCallback callback, void * context)
+{
+    _lateCallback = callback;
+    _lateContext = context;
+}
 
-    for (_attempt=0; _attempt<nRetries; ++_attempt)
+int8_t ICMPReplyDispatcher::findRequest(uint16_t id, uint16_t seq, const IPAddress& addr) const
+{
+    for (uint8_t i = 0; i < ICMPPING_HISTORY; ++i)
     {
+        const Request& request = _requests[i];
+        if (request.state != REQUEST_FREE && request.id == id && request.seq == seq
+                && addr == request.addr)
+            return i;
+    }
+    return -1;
+}
 
-    	ICMPPING_DOYIELD();
+int8_t ICMPReplyDispatcher::findHeld(uint16_t id, uint16_t seq, const IPAddress& addr) const
+{
+    int8_t request = findRequest(id, seq, addr);
+    if (request < 0)
+        return -1;
+    for (uint8_t i = 0; i < ICMPPING_MAILBOX; ++i)
+    {
+        if (_mailbox[i].request == request)
+            return i;
+    }
+    return -1;
+}
 
-        result.status = sendEchoRequest(addr, echoReq);
-        if (result.status == SUCCESS)
-        {
-            byte replyAddr [4];
-        	ICMPPING_DOYIELD();
-            receiveEchoReply(echoReq, addr, result);
-        }
-        if (result.status == SUCCESS)
-        {
-            break;
-        }
+int8_t ICMPReplyDispatcher::findOldest(uint8_t state, icmp_time_t now) const
+{
+    int8_t oldest = -1;
+    for (uint8_t i = 0; i < ICMPPING_HISTORY; ++i)
+    {
+        if (_requests[i].state == state
+                && (oldest < 0 || now - _requests[i].sent > now - _requests[oldest].sent))
+            oldest = i;
     }
-   
-    W5100.execCmdSn(_socket, Sock_CLOSE);
-    W5100.writeSnIR(_socket, 0xFF);
+    return oldest;
 }
 
-ICMPEchoReply ICMPPing::operator()(const IPAddress& addr, int nRetries)
+bool ICMPReplyDispatcher::expects(uint16_t id) const
 {
-    ICMPEchoReply reply;
-    operator()(addr, nRetries, reply);
-    return reply;
+    for (uint8_t i = 0; i < ICMPPING_HISTORY; ++i)
+    {
+        if (_requests[i].state != REQUEST_FREE && _requests[i].id == id)
+            return true;
+    }
+    return false;
 }
 
-Status ICMPPing::sendEchoRequest(const IPAddress& addr, const ICMPEcho& echoReq)
+void ICMPReplyDispatcher::sent(uint16_t id, uint16_t seq, const IPAddress& addr, icmp_time_t sent)
 {
-    // I wish there were a better way of doing this, but if we use the uint32_t
-    // cast operator, we're forced to (1) cast away the constness, and (2) deal
-    // with an endianness nightmare.
-    uint8_t addri [] = {addr[0], addr[1], addr[2], addr[3]};
-    W5100.writeSnDIPR(_socket, addri);
-    W5100.writeSnTTL(_socket, 128);
-    // The port isn't used, becuause ICMP is a network-layer protocol. So we
-    // write zero. This probably isn't actually necessary.
-    W5100.writeSnDPORT(_socket, 0);
+    int8_t i = findRequest(id, seq, addr);
+    if (i < 0)
+    {
+        // take a free slot if there is one, or else forget the oldest
+        // request that nobody's waiting on, or failing that the oldest.
+        i = findOldest(REQUEST_FREE, sent);
+        if (i < 0)
+            i = findOldest(REQUEST_EXPIRED, sent);
+        if (i < 0)
+            i = findOldest(REQUEST_WAITING, sent);
+        for (uint8_t j = 0; j < ICMPPING_MAILBOX; ++j)
+        {
+            if (_mailbox[j].request == i)
+                _mailbox[j].request = NO_REQUEST;
+        }
 
-    uint8_t serialized [sizeof(ICMPEcho)];
-    echoReq.serialize(serialized);
+        Request& request = _requests[i];
+        request.id = id;
+        request.seq = seq;
+        for (uint8_t j = 0; j < 4; ++j)
+            request.addr[j] = addr[j];
+    }
+    _requests[i].sent = sent;
+    _requests[i].state = REQUEST_WAITING;
+}
 
-    W5100.send_data_processing(_socket, serialized, sizeof(ICMPEcho));
-    W5100.execCmdSn(_socket, Sock_SEND);
+void ICMPReplyDispatcher::finished(uint16_t id, uint16_t seq, const IPAddress& addr, Status status)
+{
+    int8_t i = findRequest(id, seq, addr);
+    if (i < 0)
+        return;
 
-    while ((W5100.readSnIR(_socket) & SnIR::SEND_OK) != SnIR::SEND_OK) 
+    if (status == SUCCESS)
     {
-        if (W5100.readSnIR(_socket) & SnIR::TIMEOUT)
-        {
-            W5100.writeSnIR(_socket, (SnIR::SEND_OK | SnIR::TIMEOUT));
-            return SEND_TIMEOUT;
-        }
+        _requests[i].state = REQUEST_FREE;
+        return;
+    }
 
-        ICMPPING_DOYIELD();
+    // a reply that came in for it while nobody was looking is late now.
+    _requests[i].state = REQUEST_EXPIRED;
+    for (uint8_t j = 0; j < ICMPPING_MAILBOX; ++j)
+    {
+        if (_mailbox[j].request == i)
+            expireHeld(j);
     }
-    W5100.writeSnIR(_socket, SnIR::SEND_OK);
-    return SUCCESS;
 }
 
-void ICMPPing::receiveEchoReply(const ICMPEcho& echoReq, const IPAddress& addr, ICMPEchoReply& echoReply)
+void ICMPReplyDispatcher::expireHeld(uint8_t i)
 {
-    icmp_time_t start = millis();
-    while (millis() - start < ping_timeout)
+    Held& held = _mailbox[i];
+    Request& request = _requests[held.request];
+    held.request = NO_REQUEST;
+    // anything after the first reply is a duplicate.
+    request.state = REQUEST_FREE;
+    ++_late;
+    if (_lateCallback)
+        _lateCallback(IPAddress(request.addr), request.seq, held.arrived - request.sent, _lateContext);
+}
+
+void ICMPReplyDispatcher::dispatch(uint16_t id, uint16_t seq, const IPAddress& addr, const IPAddress& from,
+                                   uint8_t type, uint8_t ttl, icmp_time_t arrived)
+{
+    int8_t request = findRequest(id, seq, addr);
+    if (request < 0 || findHeld(id, seq, addr) >= 0)
     {
+        ++_strays;
+        return;
+    }
 
-        if (W5100.getRXReceivedSize(_socket) < 1)
+    // hold it even if it's late, so that there's just the one way of
+    // reporting late replies.
+    int8_t i = -1;
+    for (uint8_t j = 0; j < ICMPPING_MAILBOX; ++j)
+    {
+        if (_mailbox[j].request == NO_REQUEST)
         {
-        	// take a break, maybe let platform do
-        	// some background work (like on ESP8266)
-        	ICMPPING_DOYIELD();
-        	continue;
+            i = j;
+            break;
         }
+    }
+    if (i < 0)
+    {
+        // full, so make room by giving up on the oldest.
+        i = 0;
+        for (uint8_t j = 1; j < ICMPPING_MAILBOX; ++j)
+        {
+            if (arrived - _mailbox[j].arrived > arrived - _mailbox[i].arrived)
+                i = j;
+        }
+        expireHeld(i);
+    }
 
-        // ah! we did receive something... check it out.
-
-        uint8_t ipHeader[6];
-		uint8_t buffer = W5100.readSnRX_RD(_socket);
-		W5100.read_data(_socket, (uint16_t) buffer, ipHeader, sizeof(ipHeader));
-		buffer += sizeof(ipHeader);
-		for (int i = 0; i < 4; ++i)
-			echoReply.addr[i] = ipHeader[i];
-		uint8_t dataLen = ipHeader[4];
-		dataLen = (dataLen << 8) + ipHeader[5];
-
-		uint8_t serialized[sizeof(ICMPEcho)];
-		if (dataLen > sizeof(ICMPEcho))
-			dataLen = sizeof(ICMPEcho);
-		W5100.read_data(_socket, (uint16_t) buffer, serialized, dataLen);
-		echoReply.data.deserialize(serialized);
-
-		buffer += dataLen;
-		W5100.writeSnRX_RD(_socket, buffer);
-		W5100.execCmdSn(_socket, Sock_RECV);
-
-		echoReply.ttl = W5100.readSnTTL(_socket);
-
-		// Since there aren't any ports in ICMP, we need to manually inspect the response
-		// to see if it originated from the request we sent out.
-		switch (echoReply.data.icmpHeader.type) {
-		case ICMP_ECHOREP: {
-			if (echoReply.data.id == echoReq.id
-					&& echoReply.data.seq == echoReq.seq) {
-				echoReply.status = SUCCESS;
-				return;
-			}
-			break;
-		}
-		case TIME_EXCEEDED: {
-			uint8_t * sourceIpHeader = echoReply.data.payload;
-			unsigned int ipHeaderSize = (sourceIpHeader[0] & 0x0F) * 4u;
-			uint8_t * sourceIcmpHeader = echoReply.data.payload + ipHeaderSize;
-
-			// The destination ip address in the originating packet's IP header.
-			IPAddress sourceDestAddress(sourceIpHeader + ipHeaderSize - 4);
-
-			if (!(sourceDestAddress == addr))
-				continue;
-
-			uint16_t sourceId = ntohs(*(uint16_t * )(sourceIcmpHeader + 4));
-			uint16_t sourceSeq = ntohs(*(uint16_t * )(sourceIcmpHeader + 6));
-
-			if (sourceId == echoReq.id && sourceSeq == echoReq.seq) {
-				echoReply.status = BAD_RESPONSE;
-				return;
-			}
-			break;
-		}
-		}
-
+    Held& held = _mailbox[i];
+    held.request = request;
+    held.type = type;
+    held.ttl = ttl;
+    for (uint8_t j = 0; j < 4; ++j)
+        held.from[j] = from[j];
+    held.arrived = arrived;
 
-    }
-    echoReply.status = NO_RESPONSE;
+    if (_requests[request].state == REQUEST_EXPIRED)
+        expireHeld(i);
 }
 
 
+uint16_t ICMPPingBase::ping_timeout = PING_TIMEOUT;
+
+#ifdef ICMPPING_PROFILE_ENABLE
+ICMPPingProfile _pingProfile;
 
+void ICMPPingBase::resetProfile()
+{
+    memset(&_pingProfile, 0, sizeof(_pingProfile));
+}
+#endif
+
+#ifdef ICMPPING_INTERRUPTS_ENABLE
+volatile bool ICMPPingBase::_interrupted = false;
+uint8_t ICMPPingBase::_interruptPin = ICMPPING_NO_INTERRUPT;
+uint8_t ICMPPingBase::_openSockets = 0;
+#endif
+
+ICMPPingBase::ICMPPingBase(SOCKET socket, uint16_t id) :
 #ifdef ICMPPING_ASYNCH_ENABLE
-/*
- * When ICMPPING_ASYNCH_ENABLE is defined, we have access to the
- * asyncStart()/asyncComplete() methods from the API.
- */
-bool ICMPPing::asyncSend(ICMPEchoReply& result)
+  _curSeq(0), _numRetries(0), _asyncsent(0), _asyncstatus(BAD_RESPONSE),
+#endif
+  _id(id), _nextSeq(0), _socket(socket),  _attempt(0), _session(false), _estimator(NULL), _pacer(NULL),
+  _dispatcher(NULL)
+{
+}
+
+void ICMPPingBase::begin()
 {
-    ICMPEcho echoReq(ICMP_ECHOREQ, _id, _curSeq, _payload);
+    openSocket(_socket);
+    _session = true;
+    _sequence.reset();
+}
 
-    Status sendOpResult(NO_RESPONSE);
-    bool sendSuccess = false;
-    for (uint8_t i=_attempt; i<_numRetries; ++i)
-    {
-    	_attempt++;
-
-    	ICMPPING_DOYIELD();
-    	sendOpResult = sendEchoRequest(_addr, echoReq);
-    	if (sendOpResult == SUCCESS)
-    	{
-    		sendSuccess = true; // it worked
-    		sendOpResult = ASYNC_SENT; // we're doing this async-style, force the status
-    		_asyncstart = millis(); // not the start time, for timeouts
-    		break; // break out of this loop, 'cause we're done.
-
-    	}
-    }
-    _asyncstatus = sendOpResult; // keep track of this, in case the ICMPEchoReply isn't re-used
-    result.status = _asyncstatus; // set the result, in case the ICMPEchoReply is checked
-    return sendSuccess; // return success of send op
+void ICMPPingBase::end()
+{
+    _session = false;
+    closeSocket(_socket);
 }
-bool ICMPPing::asyncStart(const IPAddress& addr, int nRetries, ICMPEchoReply& result)
+
+#ifdef ICMPPING_INTERRUPTS_ENABLE
+void ICMPPingBase::useInterrupt(uint8_t pin)
 {
-	openSocket();
+    if (_interruptPin != ICMPPING_NO_INTERRUPT)
+        detachInterrupt(digitalPinToInterrupt(_interruptPin));
+
+    _interruptPin = pin;
+    _interrupted = false;
+    if (pin != ICMPPING_NO_INTERRUPT)
+    {
+        pinMode(pin, INPUT_PULLUP);
+        attachInterrupt(digitalPinToInterrupt(pin), handleInterrupt, FALLING);
+    }
 
-	// stash our state, so we can access
-	// in asynchSend()/asyncComplete()
-	_numRetries = nRetries;
-	_attempt = 0;
-	_curSeq = _nextSeq++;
-	_addr = addr;
+    // sockets opened before now, by begin() or a scheduler, never had their
+    // interrupts enabled.
+    for (SOCKET s = 0; s < MAX_SOCK_NUM; ++s)
+    {
+        if (_openSockets & (1 << s))
+            ICMPPingChip::enableInterrupt(s, pin != ICMPPING_NO_INTERRUPT);
+    }
+}
 
-	return asyncSend(result);
+void ICMPPingBase::handleInterrupt()
+{
+    // just make a note: the SPI bus may be busy with something else, so
+    // the registers get read from checkInterrupt(), in the main loop.
+    _interrupted = true;
+}
+#endif
 
+bool ICMPPingBase::checkInterrupt(const SOCKET * sockets, uint8_t numSockets)
+{
+#ifdef ICMPPING_LINUX
+    // no INT pin, but epoll will do the same job without spinning.
+    return ICMPPingChip::wait(sockets, numSockets, 1);
+#else
+    (void)sockets;
+    (void)numSockets;
+#endif
+#ifdef ICMPPING_INTERRUPTS_ENABLE
+    if (_interruptPin != ICMPPING_NO_INTERRUPT)
+    {
+        // INT stays low for as long as any enabled socket interrupt is set, so
+        // if it's still low someone has an event they haven't cleared yet,
+        // even if it didn't give us a new falling edge.
+        bool interrupted = _interrupted;
+        _interrupted = false;
+        return interrupted || digitalRead(_interruptPin) == LOW;
+    }
+#endif
+    return true;
 }
 
-bool ICMPPing::asyncComplete(ICMPEchoReply& result)
+void ICMPPingBase::acknowledgeReceive(SOCKET s)
 {
+#ifdef ICMPPING_INTERRUPTS_ENABLE
+    if (_interruptPin != ICMPPING_NO_INTERRUPT)
+        ICMPPingChip::clearIR(s, SnIR::RECV);
+#else
+    (void)s;
+#endif
+}
 
-	if (_asyncstatus != ASYNC_SENT)
-	{
-		// we either:
-		//  - didn't start an async request;
-		//	- failed to send; or
-		//	- are no longer waiting on this packet.
-		// either way, we're done
-		return true;
-	}
+uint16_t ICMPPingBase::receivedSum(SOCKET s, uint16_t ptr, uint16_t len)
+{
+    // a chunk at a time, each an even number of bytes, so that their sums
+    // can just be added up.
+    unsigned long sum = 0;
+    uint8_t chunk[32];
+    while (len > 0)
+    {
+        uint16_t n = len < sizeof(chunk) ? len : sizeof(chunk);
+        ICMPPingChip::read(s, ptr, chunk, n);
+        sum += _onesSum(chunk, n);
+        ptr += n;
+        len -= n;
+    }
+    return _foldSum(sum);
+}
 
+icmp_time_t ICMPPingBase::replyTimeout(const ICMPTimeoutEstimator * estimator)
+{
+    return estimator ? estimator->timeout() : ping_timeout * ICMPPING_RTT_PER_MS;
+}
 
-	if (W5100.getRXReceivedSize(_socket))
-	{
-		// ooooh, we've got a pending reply
-	    ICMPEcho echoReq(ICMP_ECHOREQ, _id, _curSeq, _payload);
-		receiveEchoReply(echoReq, _addr, result);
-		_asyncstatus = result.status; // make note of this status, whatever it is.
-		return true; // whatever the result of the receiveEchoReply(), the async op is done.
-	}
+void ICMPPingBase::updateTimeout(ICMPTimeoutEstimator * estimator, Status status, icmp_time_t rtt,
+                                 uint8_t attempt)
+{
+    if (!estimator)
+        return;
+    if (status == NO_RESPONSE)
+        estimator->backoff();
+    else if (status == SUCCESS && attempt == 1)
+        estimator->addSample(rtt);
+}
 
-	// nothing yet... check if we've timed out
-	if ( (millis() - _asyncstart) > ping_timeout)
-	{
+void ICMPPingBase::waitForPacer(const IPAddress& addr)
+{
+    while (_pacer && !_pacer->take(addr))
+    {
+        ICMPPING_DOYIELD();
+    }
+}
 
-		// yep, we've timed out...
-		if (_attempt < _numRetries)
-		{
-			// still, this wasn't our last attempt, let's try again
-			if (asyncSend(result))
-			{
-				// another send has succeeded
-				// we'll wait for that now...
-				return false;
-			}
+void ICMPPingBase::prepareSocket()
+{
+    // with a dispatcher, whatever is left in the socket might be a late
+    // reply, or someone else's, so leave it to be read.
+    if (!_session)
+        openSocket(_socket);
+    else if (!_dispatcher)
+        drainSocket(_socket);
+}
 
-			// this send has failed. too bad,
-			// we are done.
-			return true;
-		}
+void ICMPPingBase::releaseSocket()
+{
+    if (!_session)
+        closeSocket(_socket);
+}
 
-		// we timed out and have no more attempts left...
-		// hello?  is anybody out there?
-		// guess not:
-	    result.status = NO_RESPONSE;
-	    return true;
-	}
+void ICMPPingBase::openSocket(SOCKET s)
+{
+    ICMPPING_PROFILE(uint32_t start = micros());
+    ICMPPingChip::openSocket(s);
+#ifdef ICMPPING_INTERRUPTS_ENABLE
+    _openSockets |= 1 << s;
+    if (_interruptPin != ICMPPING_NO_INTERRUPT)
+        ICMPPingChip::enableInterrupt(s, true);
+#endif
+    ICMPPING_COUNT(socketTime, micros() - start);
+}
 
-	// have yet to time out, will wait some more:
-	return false; // results still not in
+void ICMPPingBase::closeSocket(SOCKET s)
+{
+    ICMPPING_PROFILE(uint32_t start = micros());
+#ifdef ICMPPING_INTERRUPTS_ENABLE
+    _openSockets &= ~(1 << s);
+    if (_interruptPin != ICMPPING_NO_INTERRUPT)
+        ICMPPingChip::enableInterrupt(s, false);
+#endif
+    ICMPPingChip::closeSocket(s);
+    ICMPPING_COUNT(socketTime, micros() - start);
+}
 
+void ICMPPingBase::drainSocket(SOCKET s)
+{
+    // skip the read pointer over everything that's there in one go, rather
+    // than datagram by datagram.
+    ICMPPING_PROFILE(uint32_t start = micros());
+    acknowledgeReceive(s);
+    uint16_t size = ICMPPingChip::rxSize(s);
+    if (size > 0)
+        ICMPPingChip::release(s, ICMPPingChip::rxPointer(s) + size);
+    ICMPPING_COUNT(socketTime, micros() - start);
 }
 
-#endif	/* ICMPPING_ASYNCH_ENABLE */
+icmp_time_t ICMPPingBase::startEchoRequest(SOCKET s, const IPAddress& addr, uint16_t id, uint16_t seq,
+                                           uint8_t const * payload, uint16_t payloadSize, uint16_t payloadSum,
+                                           uint8_t ttl)
+{
+    // build just the header, and let the chip stitch the payload on after it.
+    ICMPPING_PROFILE(uint32_t start = micros());
+    ICMPEchoT<0> echoReq;
+    echoReq.icmpHeader.type = ICMP_ECHOREQ;
+    echoReq.id = id;
+    echoReq.seq = seq;
+    echoReq.time = millis();
+    echoReq.icmpHeader.checksum = _checksum(echoReq.icmpHeader, id, seq, echoReq.time, payloadSum);
+
+    uint8_t header [ICMPEchoT<0>::wireSize];
+    echoReq.serialize(header);
+
+    ICMPPingChip::send(s, addr, ttl, header, sizeof(header), payload, payloadSize);
+    ICMPPING_COUNT(requests, 1);
+    ICMPPING_COUNT(sendTime, micros() - start);
+    return echoReq.time;
+}
 
+Status ICMPPingBase::pollEchoRequest(SOCKET s)
+{
+    uint8_t ir = ICMPPingChip::readIR(s);
+    if (ir & SnIR::SEND_OK)
+    {
+        ICMPPingChip::clearIR(s, SnIR::SEND_OK);
+        return SUCCESS;
+    }
+    if (ir & SnIR::TIMEOUT)
+    {
+        ICMPPingChip::clearIR(s, (SnIR::SEND_OK | SnIR::TIMEOUT));
+        return SEND_TIMEOUT;
+    }
+    return ASYNC_SENT;
+}
 
+Status ICMPPingBase::sendEchoRequest(SOCKET s, const IPAddress& addr, uint16_t id, uint16_t seq,
+                                     uint8_t const * payload, uint16_t payloadSize, uint16_t payloadSum,
+                                     uint8_t ttl)
+{
+    startEchoRequest(s, addr, id, seq, payload, payloadSize, payloadSum, ttl);
+    return waitEchoRequest(s);
+}
 
+Status ICMPPingBase::waitEchoRequest(SOCKET s)
+{
+    ICMPPING_PROFILE(uint32_t start = micros());
+    icmp_time_t sent = millis();
+    icmp_time_t polled = sent;
+    Status status = ASYNC_SENT;
+    while (true)
+    {
+        // INT only saves us polling, so if it doesn't come, poll anyway.
+        icmp_time_t now = millis();
+        if (checkInterrupt(s) || now != polled)
+        {
+            polled = now;
+            if ((status = pollEchoRequest(s)) != ASYNC_SENT)
+                break;
+        }
+        if (now - sent >= ping_timeout)
+        {
+            // the W5100 should have given up on its own long before this,
+            // so it's stuck. Reopening it is the only way to stop it.
+            openSocket(s);
+            status = SEND_TIMEOUT;
+            break;
+        }
+        ICMPPING_DOYIELD();
+    }
+    ICMPPING_COUNT(sendTime, micros() - start);
+    return status;
+}
@@ -7,16 +7,48 @@
  * published by the Free Software Foundation.
  */
 
+#ifndef ICMPPING_H
+#define ICMPPING_H
+
+// ICMPPING_PLATFORM_HEADER -- normally the library talks to the W5100
+// through the Ethernet library and the Arduino core. To build it somewhere
+// else (on a PC, against a simulated W5100, say), define this to a quoted
+// header name that provides those instead, and it will be included in their
+// place: byte, SOCKET, MAX_SOCK_NUM, IPAddress, Print, millis(), micros(),
+// delay(), the SnIR, SnMR, SnSR, IPPROTO and SockCMD constants, and a W5100
+// object with the calls ICMPPingW5100 in ICMPPingChip.h makes. See
+// extras/sim/W5100Sim.h, which is one:
+// -DICMPPING_PLATFORM_HEADER='"extras/sim/W5100Sim.h"'
+//
+// ICMPPING_W5500 -- define this to use a W5500, through the Ethernet2
+// library, rather than a W5100. See ICMPPingChip.h.
+//
+// ICMPPING_LINUX -- define this (on the compiler's command line) to build
+// for Linux, pinging through the kernel's ICMP sockets rather than a W5100.
+// See ICMPPingLinux.h and ICMPPingChip.h.
+#ifdef ICMPPING_PLATFORM_HEADER
+#include ICMPPING_PLATFORM_HEADER
+#elif defined(ICMPPING_LINUX)
+#include "ICMPPingLinux.h"
+#elif defined(ICMPPING_W5500)
+#include <SPI.h>
+#include <Ethernet2.h>
+#include <utility/w5500.h>
+#else
 #include <SPI.h>
 #include <Ethernet.h>
 #include <utility/w5100.h>
+#endif
 
+// REQ_DATASIZE -- the payload size of ICMPPing, ICMPEcho and ICMPEchoReply.
+// Use ICMPPingT<size> etc. for other sizes.
 #define REQ_DATASIZE 64
 #define ICMP_ECHOREPLY 0
 #define ICMP_ECHOREQ 8
 #define ICMP_ECHOREP 0
 #define TIME_EXCEEDED 11
 #define PING_TIMEOUT 1000
+#define PING_TTL 128
 
 
 // ICMPPING_ASYNCH_ENABLE -- define this to enable asynch operations
@@ -30,10 +62,102 @@
 // will call a short delay() at critical junctures.
 // #define ICMPPING_INSERT_YIELDS
 
-typedef unsigned long icmp_time_t;
+// ICMPPING_INTERRUPTS_ENABLE -- define this to be able to wait on the W5100's
+// INT pin instead of polling its registers over SPI the whole time a ping
+// is in progress. See ICMPPing::useInterrupt().
+// #define ICMPPING_INTERRUPTS_ENABLE
+
+// ICMPPING_MICROS_ENABLE -- define this to measure round trip times with
+// micros() rather than millis(). ICMPEchoReply::rtt is then in microseconds.
+// The time field in the packet itself is still in milliseconds.
+// ICMPPING_RTT_UNIT is the matching "us" or "ms", for printing RTTs.
+// #define ICMPPING_MICROS_ENABLE
+
+// ICMPPING_PROFILE_ENABLE -- define this to keep count of how much work the
+// library makes the W5100 do, and of how long each part of a ping takes. See
+// ICMPPing::profile(). Without it, none of the counting is compiled in.
+// #define ICMPPING_PROFILE_ENABLE
+
+// ICMPPING_MIN_TIMEOUT, ICMPPING_MAX_TIMEOUT -- limits, in ms, on the timeouts
+// that ICMPTimeoutEstimator works out.
+#ifndef ICMPPING_MIN_TIMEOUT
+#define ICMPPING_MIN_TIMEOUT 20
+#endif
+#ifndef ICMPPING_MAX_TIMEOUT
+#define ICMPPING_MAX_TIMEOUT 5000
+#endif
+
+// ICMPPING_HISTORY -- the number of recent echo requests an
+// ICMPReplyDispatcher remembers, so that it can tell what a reply that turns
+// up late was for. Each costs 13 bytes of RAM.
+#ifndef ICMPPING_HISTORY
+#define ICMPPING_HISTORY 8
+#endif
+
+// ICMPPING_MAILBOX -- the number of replies an ICMPReplyDispatcher can hold
+// for objects sharing the socket that haven't gone looking for them yet.
+// Each costs 11 bytes of RAM.
+#ifndef ICMPPING_MAILBOX
+#define ICMPPING_MAILBOX 4
+#endif
+
+// pass this to ICMPPing::useInterrupt() to go back to polling.
+#define ICMPPING_NO_INTERRUPT 0xFF
+
+#ifdef ICMPPING_MICROS_ENABLE
+#define ICMPPING_RTT_CLOCK()	micros()
+#define ICMPPING_RTT_PER_MS		1000UL
+#define ICMPPING_RTT_UNIT		"us"
+#else
+#define ICMPPING_RTT_CLOCK()	millis()
+#define ICMPPING_RTT_PER_MS		1UL
+#define ICMPPING_RTT_UNIT		"ms"
+#endif
+
+#ifdef ICMPPING_INSERT_YIELDS
+#define ICMPPING_DOYIELD()		delay(2)
+#else
+#define ICMPPING_DOYIELD()
+#endif
+
+#ifdef ICMPPING_PROFILE_ENABLE
+struct ICMPPingProfile
+{
+    /*
+    Running totals for all ICMPPing objects, from ICMPPing::profile().
+    Register accesses are counted as the Ethernet library calls that make
+    them, however many bytes each one moves, and the times are in us.
+    */
+    uint32_t registerReads;
+    uint32_t registerWrites;
+    uint32_t bytesRead; // out of socket RX buffers
+    uint32_t bytesWritten; // into socket TX buffers
+    uint32_t requests; // echo requests handed to the chip
+    uint32_t foreignPackets; // not for our id, or unreadable, so skipped
+    uint32_t staleReplies; // for our id, but not for a request we were waiting on
+    uint32_t socketTime; // opening, draining and closing the socket
+    uint32_t sendTime; // building requests and waiting for SEND_OK (ARP included)
+    uint32_t waitTime; // waiting for replies to arrive
+    uint32_t readTime; // reading replies out of the RX buffer
+};
+
+extern ICMPPingProfile _pingProfile;
+
+// ICMPPING_PROFILE(...) compiles its argument only if ICMPPING_PROFILE_ENABLE
+// is defined, and ICMPPING_COUNT adds n to one of the _pingProfile totals.
+#define ICMPPING_PROFILE(...)		__VA_ARGS__
+#else
+#define ICMPPING_PROFILE(...)
+#endif
+#define ICMPPING_COUNT(field, n)	ICMPPING_PROFILE(_pingProfile.field += (n))
+
+// the time field in the packet is 32 bits, whatever size a long is.
+typedef uint32_t icmp_time_t;
+
+#include "ICMPPingChip.h"
 
-class ICMPHeader;
-class ICMPPing;
+struct ICMPHeader;
+class ICMPPacer;
 
 typedef enum Status
 {
@@ -46,7 +170,8 @@ typedef enum Status
     SEND_TIMEOUT = 1, // Timed out sending the request
     NO_RESPONSE = 2, // Died waiting for a response
     BAD_RESPONSE = 3, // we got back the wrong type
-    ASYNC_SENT = 4
+    ASYNC_SENT = 4,
+    BAD_CHECKSUM = 5 // we got back a reply that was damaged on the way
 } Status;
 
 
@@ -61,11 +186,52 @@ struct ICMPHeader
 };
 
 
-struct ICMPEcho
+inline uint16_t _makeUint16(const uint8_t& highOrder, const uint8_t& lowOrder)
+{
+    // make a 16-bit unsigned integer given the high order and low order bytes.
+    return ((uint16_t)highOrder << 8) | lowOrder;
+}
+
+inline uint16_t _foldSum(unsigned long sum)
+{
+    // fold the carries back in to get a 16-bit ones complement sum
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += (sum >> 16);
+    return sum;
+}
+
+inline icmp_time_t _elapsed(icmp_time_t start, icmp_time_t end)
+{
+    // the time from start to end, unsigned so that it's right even if the
+    // clock wrapped around in between. A reply the chip stamped before we
+    // noticed the request had gone out counts as 0.
+    return (int32_t)(end - start) < 0 ? 0 : end - start;
+}
+
+/*
+Calculates the (uncomplemented) ones complement sum of len bytes, taken as big
+endian 16-bit words, with a zero after the last byte if len is odd. Sums of
+separate pieces can be added together and folded with _foldSum(), as long as
+every piece but the last has an even length.
+*/
+uint16_t _onesSum(uint8_t const * data, uint16_t len);
+
+/*
+Calculates the checksum of an ICMP echo packet from its header fields and the
+ones complement sum of its payload.
+*/
+uint16_t _checksum(const ICMPHeader& icmpHeader, uint16_t id, uint16_t seq,
+                   icmp_time_t time, uint16_t payloadSum);
+
+
+template <uint16_t PayloadSize>
+struct ICMPEchoT
 {
     /*
     Contents of an ICMP echo packet, including the ICMP header. Does not
-    include the IP header.
+    include the IP header. PayloadSize is the number of bytes of data after
+    the header, and can be anything from zero up to what fits in a W5100
+    socket buffer.
     */
 
     /*
@@ -78,33 +244,54 @@ struct ICMPEcho
     @param payload: An arbitrary chunk of data that we expect to get back in
     the response.
     */
-    ICMPEcho(uint8_t type, uint16_t _id, uint16_t _seq, uint8_t * _payload);
+    ICMPEchoT(uint8_t type, uint16_t _id, uint16_t _seq, uint8_t const * _payload);
+
+    /*
+    Same as above, but takes the ones complement sum of the payload, as
+    returned by payloadSum(), rather than working it out again. Use this when
+    sending the same payload over and over.
+    */
+    ICMPEchoT(uint8_t type, uint16_t _id, uint16_t _seq, uint8_t const * _payload, uint16_t _payloadSum);
 
     /*
     This constructor leaves everything zero. This is used when we receive a
     response, since we nuke whatever is here already when we copy the packet
     data out of the W5100.
     */
-    ICMPEcho();
+    ICMPEchoT();
+
+    // size of the packet on the wire, not counting the IP header.
+    static const uint16_t wireSize = 12 + PayloadSize;
 
     ICMPHeader icmpHeader;
     uint16_t id;
     uint16_t seq;
     icmp_time_t time;
-    uint8_t payload [REQ_DATASIZE];
+    uint8_t payload [PayloadSize];
+
+    /*
+    Calculate the (uncomplemented) ones complement sum of a PayloadSize
+    byte payload, for use in the checksum.
+    */
+    static uint16_t payloadSum(uint8_t const * payload);
 
     /*
-    Serialize the header as a byte array, in big endian format.
+    Serialize the packet as a byte array of wireSize bytes, in big endian
+    format.
     */
     void serialize(byte * binData) const;
     /*
-    Serialize the header as a byte array, in big endian format.
+    Deserialize the packet from a byte array of wireSize bytes, in big endian
+    format.
     */
     void deserialize(byte const * binData);
 };
 
+typedef ICMPEchoT<REQ_DATASIZE> ICMPEcho;
 
-struct ICMPEchoReply
+
+template <uint16_t PayloadSize>
+struct ICMPEchoReplyT
 {
     /*
     Struct returned by ICMPPing().
@@ -114,30 +301,298 @@ struct ICMPEchoReply
     if it failed.
     @param addr: The ip address that we received the response from. Something
     is borked if this doesn't match the IP address we pinged.
+    @param rtt: The round trip time, from when the W5100 said it had sent the
+    request to when we saw the response in its RX buffer, in ms (us if
+    ICMPPING_MICROS_ENABLE is defined). Zero if there was no response.
     */
-    ICMPEcho data;
+    ICMPEchoT<PayloadSize> data;
     uint8_t ttl;
     Status status;
     IPAddress addr;
+    icmp_time_t rtt;
 };
 
+typedef ICMPEchoReplyT<REQ_DATASIZE> ICMPEchoReply;
+
 
-class ICMPPing
+class ICMPTimeoutEstimator
 {
     /*
-    Function-object for sending ICMP ping requests.
+    Works out how long to wait for a reply from one particular host, from
+    how long it has taken to reply before, the way TCP works out its
+    retransmission timeout (RFC 6298): a smoothed RTT plus four times its
+    mean deviation, clamped to ICMPPING_MIN_TIMEOUT..ICMPPING_MAX_TIMEOUT,
+    and doubled every time a request goes unanswered. Keep one per host and
+    pass it along whenever you ping that host, and dead hosts on a fast link
+    get noticed in a few tens of ms rather than after the timeout that a
+    slow one needs.
     */
 
 public:
     /*
-    Construct an ICMP ping object.
-    @param socket: The socket number in the W5100.
-    @param id: The id to put in the ping packets. Can be pretty much any
-    arbitrary number.
+    @param initialTimeout: The timeout to use until there's been a reply to
+    learn from, in ms. If zero, use ICMPPing::timeout(), and don't back off
+    until there has been a reply.
+    */
+    ICMPTimeoutEstimator(uint16_t initialTimeout = 0);
+
+    /*
+    Forget all the RTTs seen so far, and go back to the initial timeout.
+    */
+    void reset(uint16_t initialTimeout = 0);
+
+    /*
+    @return: How long to wait for a reply, in the units of
+    ICMPEchoReply::rtt (ms, or us if ICMPPING_MICROS_ENABLE is defined).
+    */
+    icmp_time_t timeout() const;
+
+    /*
+    Learn from the RTT of a reply. Don't call this for replies to requests
+    that were sent more than once, since there's no telling which one was
+    answered (Karn's algorithm); ICMPPing takes care of that.
+    */
+    void addSample(icmp_time_t rtt);
+
+    /*
+    Double the timeout, after a request went unanswered.
     */
-    ICMPPing(SOCKET s, uint8_t id);
+    void backoff();
+
+private:
+    // smoothed RTT, times 8, and its mean deviation, times 4, as in
+    // Jacobson's paper, so that the fractions don't get lost.
+    icmp_time_t _srtt;
+    icmp_time_t _rttvar;
+    // in RTT clock units; zero while we're using ICMPPing::timeout().
+    icmp_time_t _rto;
+};
+
+
+typedef enum ICMPSequenceOrder
+{
+    /*
+    Where a reply falls in the sequence of replies seen by an
+    ICMPSequenceWindow.
+    */
+    SEQ_NEW = 0, // the highest sequence number yet
+    SEQ_REORDERED = 1, // not seen before, but overtaken by a later one
+    SEQ_DUPLICATE = 2, // seen before
+    SEQ_TOO_OLD = 3 // too far behind the highest to tell
+} ICMPSequenceOrder;
+
+
+class ICMPSequenceWindow
+{
+    /*
+    Sorts the replies to a run of echo requests into new ones, ones that
+    were overtaken by the reply to a later request, and duplicates. Keeps a
+    bitmap of which of the 32 sequence numbers up to the highest one seen
+    have been answered, the way IPsec's anti-replay window does (RFC 4303),
+    so it costs 12 bytes however long the run. Sequence numbers are compared
+    modulo 2^16, so the run can wrap around.
+    */
+
+public:
+    ICMPSequenceWindow();
+
+    /*
+    Forget everything, counters included.
+    */
+    void reset();
+
+    /*
+    Note a reply, and count it.
+    @return: Where it falls in the sequence.
+    */
+    ICMPSequenceOrder add(uint16_t seq);
+
+    /*
+    @return: The number of distinct replies, new and reordered.
+    */
+    uint32_t received() const { return _received; }
+
+    /*
+    @return: The number of those that arrived after the reply to a later
+    request.
+    */
+    uint32_t reordered() const { return _reordered; }
+
+    /*
+    @return: The number of duplicates, and replies too old to tell.
+    */
+    uint32_t duplicates() const { return _duplicates; }
+
+private:
+    uint32_t _seen; // bit i is set if _highest - i has been seen
+    uint16_t _highest;
+    uint32_t _received;
+    uint32_t _reordered;
+    uint32_t _duplicates;
+};
+
+
+class ICMPReplyDispatcher
+{
+    /*
+    Remembers the last ICMPPING_HISTORY echo requests sent by the ICMPPing
+    objects that share it, so that replies that aren't for the request being
+    waited on don't just get thrown away. A reply to a request that has
+    already timed out is counted as late, with its real RTT, instead of
+    being lost without a trace and taken for a dead host; and a reply that
+    one object reads out of the socket for a request that another is still
+    waiting on is held for the other one to pick up.
+
+    Give the same one to ICMPPing::setDispatcher() on every object that
+    pings through a socket. If several share the socket they should all be
+    in a session (see ICMPPing::begin()), since opening a socket throws
+    away everything waiting in it, and only one of them can be sending at a
+    time, since they'd share the W5100's SEND_OK flag.
+    */
+
+public:
+    /*
+    Called for each late reply.
+    @param addr: The address the request was sent to.
+    @param seq: The request's sequence number.
+    @param rtt: How long the reply took, in the units of ICMPEchoReply::rtt,
+    from the last time the request was sent until it was read out of the
+    socket, which may have been a while after it actually arrived.
+    @param context: Whatever was passed to setLateCallback().
+    */
+    typedef void (*LateCallback)(const IPAddress& addr, uint16_t seq, icmp_time_t rtt, void * context);
+
+    ICMPReplyDispatcher();
+
+    /*
+    Set the function to call for each late reply. See also
+    ICMPPingStats::addLate().
+    */
+    void setLateCallback(LateCallback callback, void * context = NULL);
+
+    /*
+    @return: The number of replies to requests that had already timed out.
+    */
+    uint32_t late() const { return _late; }
+
+    /*
+    @return: The number of replies that weren't for any request still
+    remembered: duplicates, replies to requests too old to remember,
+    someone else's, or ones that were damaged on the way.
+    */
+    uint32_t strays() const { return _strays; }
+
+    /*
+    The rest is for ICMPPing. A request is identified by its id, seq and
+    destination; sent() is called every time it goes out, and finished()
+    once its sender stops waiting for it, after which any reply is late.
+    */
+    void sent(uint16_t id, uint16_t seq, const IPAddress& addr, icmp_time_t sent);
+    void finished(uint16_t id, uint16_t seq, const IPAddress& addr, Status status);
+
+    /*
+    @return: Whether some request with the given id is remembered, i.e.
+    whether replies with that id should be read rather than skipped.
+    */
+    bool expects(uint16_t id) const;
+
+    /*
+    Deals with a reply read by an object that wasn't waiting for it: holds
+    it for the object that is, or counts it as late or a stray.
+    @param seq, addr: The sequence number and destination of the request
+    it answers, as found by ICMPPing::readEchoReply().
+    */
+    template <uint16_t PayloadSize>
+    void dispatch(const ICMPEchoReplyT<PayloadSize>& reply, uint16_t seq, const IPAddress& addr)
+    {
+        // there's no telling who a damaged one was really for.
+        if (reply.status == BAD_CHECKSUM)
+        {
+            ++_strays;
+            return;
+        }
+        dispatch(reply.data.id, seq, addr, reply.addr, reply.data.icmpHeader.type, reply.ttl, reply.rtt);
+    }
+
+    /*
+    @return: Whether a reply to the given request is being held.
+    */
+    bool holds(uint16_t id, uint16_t seq, const IPAddress& addr) const
+    {
+        return findHeld(id, seq, addr) >= 0;
+    }
+
+    /*
+    Picks up a reply to the given request that someone else read, if there
+    is one. The payload isn't kept, so only the ICMP type, id and seq of
+    data are filled in, along with addr, ttl, and rtt, which is the
+    ICMPPING_RTT_CLOCK() time at which the reply was found, just like from
+    ICMPPing::readEchoReply().
+    @return: false if there isn't one.
+    */
+    template <uint16_t PayloadSize>
+    bool collect(uint16_t id, uint16_t seq, const IPAddress& addr, ICMPEchoReplyT<PayloadSize>& reply);
+
+private:
 
+    void dispatch(uint16_t id, uint16_t seq, const IPAddress& addr, const IPAddress& from,
+                  uint8_t type, uint8_t ttl, icmp_time_t arrived);
+
+    // the index of the request in _requests, or -1.
+    int8_t findRequest(uint16_t id, uint16_t seq, const IPAddress& addr) const;
+    // the index in _mailbox of a reply to the request, or -1.
+    int8_t findHeld(uint16_t id, uint16_t seq, const IPAddress& addr) const;
+    // the index of the request in the given state sent longest before now,
+    // or -1.
+    int8_t findOldest(uint8_t state, icmp_time_t now) const;
+
+    // count the reply held in _mailbox[i] as late, and empty its slot.
+    void expireHeld(uint8_t i);
+
+    enum RequestState
+    {
+        REQUEST_FREE = 0,
+        REQUEST_WAITING, // its sender is still waiting for the reply
+        REQUEST_EXPIRED // its sender gave up, so the reply will be late
+    };
+
+    struct Request
+    {
+        uint16_t id;
+        uint16_t seq;
+        uint8_t addr[4];
+        icmp_time_t sent; // ICMPPING_RTT_CLOCK() time
+        uint8_t state;
+    };
+
+    struct Held
+    {
+        uint8_t request; // index into _requests, or NO_REQUEST if free
+        uint8_t type;
+        uint8_t ttl;
+        uint8_t from[4];
+        icmp_time_t arrived; // ICMPPING_RTT_CLOCK() time
+    };
+
+    static const uint8_t NO_REQUEST = 0xFF;
+
+    Request _requests[ICMPPING_HISTORY];
+    Held _mailbox[ICMPPING_MAILBOX];
+    uint32_t _late;
+    uint32_t _strays;
+
+    LateCallback _lateCallback;
+    void * _lateContext;
+};
+
+
+class ICMPPingBase
+{
+    /*
+    The parts of ICMPPing that don't depend on the payload size.
+    */
 
+public:
     /*
      Control the ping timeout (ms).  Defaults to PING_TIMEOUT (1000ms) but can
      be set using setTimeout(MS).
@@ -152,6 +607,268 @@ public:
      */
     static uint16_t timeout() { return ping_timeout;}
 
+    /*
+     Pings made by this object use estimator to decide how long to wait for
+     a reply, and teach it from the replies they get. NULL, the default,
+     goes back to waiting timeout() ms every time. One object pinging
+     several hosts should set the right one before each ping; see also the
+     ICMPMultiPing operator(), which takes one per host.
+     */
+    void setTimeoutEstimator(ICMPTimeoutEstimator * estimator) { _estimator = estimator; }
+
+    /*
+     Requests sent by this object wait until pacer lets them go; see
+     ICMPPacer. Several objects can share one. NULL, the default, sends
+     them straight away.
+     */
+    void setPacer(ICMPPacer * pacer) { _pacer = pacer; }
+
+    /*
+     Replies read by this object that it wasn't waiting for go to
+     dispatcher, to be counted as late or handed to another object sharing
+     the socket, rather than thrown away; see ICMPReplyDispatcher. Several
+     objects can share one. NULL, the default, throws them away.
+     */
+    void setDispatcher(ICMPReplyDispatcher * dispatcher) { _dispatcher = dispatcher; }
+
+    /*
+     The order in which echo replies to this object's pings have arrived
+     since the last begin(), or since it was constructed: how many were
+     overtaken by the reply to a later request, and how many turned up more
+     than once. Replies are counted whether or not the ping they answer was
+     still waiting for them. With several hosts in flight at once, replies
+     from nearer hosts will overtake those from farther ones, so the reorder
+     count is mostly interesting when pinging one host.
+     */
+    const ICMPSequenceWindow& sequence() const { return _sequence; }
+
+    /*
+     Start a ping session. Normally every ping opens the socket in IPRAW mode
+     and closes it again afterwards, which costs several commands to the
+     W5100 per ping. Between begin() and end() the socket stays open, and
+     each ping just throws away anything stale waiting in the RX buffer before
+     it sends. Worth it if you're pinging more than about once a second. The
+     socket can't be used for anything else until end() is called.
+     */
+    void begin();
+
+    /*
+     End a ping session started with begin(), and close the socket.
+     */
+    void end();
+
+#ifdef ICMPPING_INTERRUPTS_ENABLE
+    /*
+     Wait for the W5100 to raise its INT line rather than polling it over
+     SPI, leaving the bus free for other devices (an SD card, say) while a
+     ping is in flight. Connect INT to a pin that supports attachInterrupt().
+     Only the interrupts for sockets we're using are enabled, including any
+     that are already open. Applies to all ICMPPing objects.
+     @param pin: The pin INT is connected to, or ICMPPING_NO_INTERRUPT to go
+     back to polling.
+     */
+    static void useInterrupt(uint8_t pin);
+#endif
+
+#ifdef ICMPPING_PROFILE_ENABLE
+    /*
+     Get a snapshot of the counters kept by all ICMPPing objects since the
+     start, or since the last resetProfile(): how many W5100 register
+     accesses and buffer bytes pinging has cost, how many packets were thrown
+     away, and where the time went. Only available if ICMPPING_PROFILE_ENABLE
+     is defined. The times are 32 bits of us, so reset every hour or so.
+     */
+    static ICMPPingProfile profile() { return _pingProfile; }
+    static void resetProfile();
+#endif
+
+protected:
+
+    ICMPPingBase(SOCKET s, uint16_t id);
+
+    /*
+    Gets our socket ready for a ping: opens it, or if we're in a session,
+    drains it, unless there's a dispatcher to hand what's in it to.
+    releaseSocket() closes it again, unless we're in a session.
+    */
+    void prepareSocket();
+    void releaseSocket();
+
+    // holds the timeout, in ms, for all objects of this class.
+    static uint16_t ping_timeout;
+
+    /*
+    How long to wait for a reply, in ICMPPING_RTT_CLOCK() units: from
+    estimator, if there is one, or ping_timeout.
+    */
+    static icmp_time_t replyTimeout(const ICMPTimeoutEstimator * estimator);
+
+    /*
+    Tell estimator, if there is one, how a request went.
+    @param status: SUCCESS or NO_RESPONSE; anything else is ignored.
+    @param rtt: The RTT, if status is SUCCESS.
+    @param attempt: How many times the request had been sent, counting from
+    one.
+    */
+    static void updateTimeout(ICMPTimeoutEstimator * estimator, Status status, icmp_time_t rtt,
+                              uint8_t attempt);
+
+    /*
+    Waits until the pacer, if there is one, lets a request go to addr.
+    */
+    void waitForPacer(const IPAddress& addr);
+
+    /*
+    Puts socket s into IPRAW mode for ICMP, closing it first if need be.
+    */
+    static void openSocket(SOCKET s);
+    static void closeSocket(SOCKET s);
+
+    /*
+    Discards everything waiting in socket s's RX buffer.
+    */
+    static void drainSocket(SOCKET s);
+
+    /*
+    Checks whether there might be news from the W5100, i.e. whether it's
+    worth reading its registers. Always true when polling; when using
+    interrupts, only true if INT has fired or is still asserted. On Linux,
+    true if one of the sockets we're waiting on has something for us, or
+    if anything new arrives within a ms.
+    @param sockets, numSockets: The sockets we're waiting on.
+    */
+    static bool checkInterrupt(const SOCKET * sockets, uint8_t numSockets);
+    static bool checkInterrupt(SOCKET s) { return checkInterrupt(&s, 1); }
+
+    /*
+    Clears socket s's RECV interrupt before we look at its RX buffer, so
+    that anything that arrives afterwards raises INT again.
+    */
+    static void acknowledgeReceive(SOCKET s);
+
+    /*
+    Hands an echo request to the W5100 for sending, without waiting for it
+    to go out. The header is built on the stack and the payload is copied
+    straight from wherever it lives into the socket's TX buffer, so the whole
+    packet never exists in RAM at once.
+    @param payloadSum: The ones complement sum of the payload, from
+    ICMPEchoT::payloadSum().
+    @param ttl: The TTL to send the request with.
+    @return: The time stamped on the request.
+    */
+    static icmp_time_t startEchoRequest(SOCKET s, const IPAddress& addr, uint16_t id, uint16_t seq,
+                                        uint8_t const * payload, uint16_t payloadSize, uint16_t payloadSum,
+                                        uint8_t ttl = PING_TTL);
+
+    /*
+    Checks on a request handed over by startEchoRequest().
+    @return: SUCCESS once the W5100 has sent it, SEND_TIMEOUT if it gave up
+    (usually because nobody answered ARP), or ASYNC_SENT if it's still trying.
+    */
+    static Status pollEchoRequest(SOCKET s);
+
+    /*
+    Sends an echo request and waits for the W5100 to finish sending it.
+    */
+    static Status sendEchoRequest(SOCKET s, const IPAddress& addr, uint16_t id, uint16_t seq,
+                                  uint8_t const * payload, uint16_t payloadSize, uint16_t payloadSum,
+                                  uint8_t ttl = PING_TTL);
+
+    /*
+    Waits for the W5100 to finish sending a request. If INT doesn't go low,
+    the socket is polled once a ms anyway, and if it's still sending after
+    the ping timeout, it's reopened and SEND_TIMEOUT returned.
+    */
+    static Status waitEchoRequest(SOCKET s);
+
+    /*
+    Reads the next reply to one of our requests waiting in socket s, if there
+    is one, into echoReply. Anything that isn't an echo reply or
+    TIME_EXCEEDED for a request with the given id, or one that dispatcher
+    expects, is skipped over in the RX buffer without being copied out of
+    it. Only addr, ttl, data, status and rtt are filled in: status is
+    SUCCESS, or BAD_CHECKSUM if the packet doesn't add up, and rtt is set to
+    the ICMPPING_RTT_CLOCK() time at which we found the reply, for the
+    caller to subtract the time the request went out from. Since there
+    aren't any ports in ICMP, we also need to work out which request the
+    reply belongs to: for an echo reply that's the reply's own seq and
+    source address, and for TIME_EXCEEDED it's the original request that the
+    router quoted back to us, which we read before it can get truncated to
+    fit the payload. The id and seq of data are set to those of the original
+    request, since the fields they'd come from are unused in TIME_EXCEEDED.
+    @param seq, addr: set to the sequence number and destination of the
+    original request.
+    @return: false if there was nothing of ours to read.
+    */
+    template <uint16_t PayloadSize>
+    static bool readEchoReply(SOCKET s, uint16_t id, ICMPEchoReplyT<PayloadSize>& echoReply,
+                              uint16_t& seq, IPAddress& addr,
+                              const ICMPReplyDispatcher * dispatcher = NULL);
+
+    // the ones complement sum of len bytes of socket s's RX buffer, from ptr.
+    static uint16_t receivedSum(SOCKET s, uint16_t ptr, uint16_t len);
+
+    /*
+    Adds a reply read by this object, or collected from the dispatcher, to
+    the sequence window, if it's a good echo reply to one of our requests.
+    */
+    void noteReply(uint16_t id, uint16_t seq, uint8_t type, Status status)
+    {
+        if (id == _id && type == ICMP_ECHOREP && status == SUCCESS)
+            _sequence.add(seq);
+    }
+
+#ifdef ICMPPING_ASYNCH_ENABLE
+    // extra internal state used when asynchronous pings
+    // are enabled.
+    uint16_t _curSeq;
+    uint8_t _numRetries;
+    icmp_time_t _asyncsent; // ICMPPING_RTT_CLOCK() time, for timeouts and the rtt
+    Status _asyncstatus;
+    IPAddress	_addr;
+#endif
+
+#ifdef ICMPPING_INTERRUPTS_ENABLE
+    static void handleInterrupt();
+
+    static volatile bool _interrupted;
+    static uint8_t _interruptPin;
+    // a bit for each socket we have open, so that useInterrupt() can enable
+    // their interrupts. IMR only has room for 8 sockets, so this does too.
+    static uint8_t _openSockets;
+#endif
+
+    uint16_t _id;
+    uint16_t _nextSeq;
+    SOCKET _socket;
+    uint8_t _attempt;
+    bool _session;
+    ICMPTimeoutEstimator * _estimator;
+    ICMPPacer * _pacer;
+    ICMPReplyDispatcher * _dispatcher;
+    ICMPSequenceWindow _sequence;
+};
+
+
+template <uint16_t PayloadSize>
+class ICMPPingT : public ICMPPingBase
+{
+    /*
+    Function-object for sending ICMP ping requests, carrying PayloadSize
+    bytes of data. ICMPPing is the usual REQ_DATASIZE byte version, but e.g.
+    ICMPPingT<0> makes for a much cheaper liveness check on small boards,
+    since the payload is stored in the object and in every ICMPEchoReplyT.
+    */
+
+public:
+    /*
+    Construct an ICMP ping object.
+    @param socket: The socket number in the W5100.
+    @param id: The id to put in the ping packets. Can be pretty much any
+    arbitrary number.
+    */
+    ICMPPingT(SOCKET s, uint16_t id);
+
 
     /*
     Pings the given IP address.
@@ -162,7 +879,7 @@ public:
     failed. If the request failed, the status indicates the reason for
     failure on the last retry.
     */
-    ICMPEchoReply operator()(const IPAddress&, int nRetries);
+    ICMPEchoReplyT<PayloadSize> operator()(const IPAddress&, int nRetries);
 
     /*
     This overloaded version of the () operator takes a (hopefully blank)
@@ -173,22 +890,22 @@ public:
     @param nRetries: Number of times to rety before giving up.
     @param result: ICMPEchoReply that will hold the result.
     */
-    void operator()(const IPAddress& addr, int nRetries, ICMPEchoReply& result);
+    void operator()(const IPAddress& addr, int nRetries, ICMPEchoReplyT<PayloadSize>& result);
 
 
 
     /*
      Use setPayload to set custom data for all ICMP packets
-     by passing it an array of [REQ_DATASIZE].  E.g.
+     by passing it an array of [PayloadSize].  E.g.
        uint8_t myPayload[REQ_DATASIZE] = { ... whatever ...};
        ICMPPing ping(pingSocket, (uint16_t)random(0, 255));
        ping.setPayload(myPayload);
        // ... as usual ...
 
-     @param payload: pointer to start of REQ_DATASIZE array of bytes to use as payload
+     @param payload: pointer to start of PayloadSize array of bytes to use as payload
 
     */
-    void setPayload(uint8_t * payload);
+    void setPayload(uint8_t const * payload);
 
 #ifdef ICMPPING_ASYNCH_ENABLE
     /*
@@ -249,7 +966,7 @@ public:
      @return: true on async request sent, false otherwise.
      @author: Pat Deegan, http://psychogenic.com
     */
-    bool asyncStart(const IPAddress& addr, int nRetries, ICMPEchoReply& result);
+    bool asyncStart(const IPAddress& addr, int nRetries, ICMPEchoReplyT<PayloadSize>& result);
 
 
     /*
@@ -262,37 +979,33 @@ public:
               false if we're still waiting for it to complete.
      @author: Pat Deegan, http://psychogenic.com
     */
-    bool asyncComplete(ICMPEchoReply& result);
+    bool asyncComplete(ICMPEchoReplyT<PayloadSize>& result);
 #endif
 
 private:
 
-    // holds the timeout, in ms, for all objects of this class.
-    static uint16_t ping_timeout;
-
-    void openSocket();
-
-    Status sendEchoRequest(const IPAddress& addr, const ICMPEcho& echoReq);
-    void receiveEchoReply(const ICMPEcho& echoReq, const IPAddress& addr, ICMPEchoReply& echoReply);
-
-
+    /*
+    Waits for the reply to a request that the W5100 finished sending at
+    ICMPPING_RTT_CLOCK() time sent.
+    */
+    void receiveEchoReply(uint16_t id, uint16_t seq, const IPAddress& addr, icmp_time_t sent,
+                          ICMPEchoReplyT<PayloadSize>& echoReply);
 
 #ifdef ICMPPING_ASYNCH_ENABLE
-    // extra internal state/methods used when asynchronous pings
-    // are enabled.
-    bool asyncSend(ICMPEchoReply& result);
-    uint8_t _curSeq;
-    uint8_t _numRetries;
-    icmp_time_t _asyncstart;
-    Status _asyncstatus;
-    IPAddress	_addr;
+    bool asyncSend(ICMPEchoReplyT<PayloadSize>& result);
 #endif
-    uint8_t _id;
-    uint8_t _nextSeq;
-    SOCKET _socket;
-    uint8_t _attempt;
 
-    uint8_t _payload[REQ_DATASIZE];
+protected:
+
+    uint8_t _payload[PayloadSize];
+    // ones complement sum of _payload, so we don't redo it for every packet.
+    uint16_t _payloadSum;
 };
 
+typedef ICMPPingT<REQ_DATASIZE> ICMPPing;
+
+#include "ICMPPingImpl.h"
+
 #pragma pack(1)
+
+#endif
@@ -0,0 +1,403 @@
+/*
+ * Copyright (c) 2010 by Blake Foster <blfoster@vassar.edu>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Everything the library asks of the Wiznet chip, in one place. Each chip
+ * gets a struct of static inline functions, and ICMPPingChip is a typedef
+ * for the one we're building for (see ICMPPING_W5500 and ICMPPING_LINUX in
+ * ICMPPing.h), so there's no cost at runtime. The rest of the library only
+ * ever talks to ICMPPingChip.
+ */
+
+#ifndef ICMPPINGCHIP_H
+#define ICMPPINGCHIP_H
+
+
+#if !defined(ICMPPING_W5500) && !defined(ICMPPING_LINUX)
+
+struct ICMPPingW5100
+{
+    /*
+    The W5100, through the Ethernet library's W5100 object (or whatever
+    ICMPPING_PLATFORM_HEADER provides instead). With ICMPPING_PROFILE_ENABLE,
+    each function counts the register accesses it makes; a command is a
+    write to Sn_CR and at least one read to see that it's been taken.
+    */
+
+    // put socket s into IPRAW mode for ICMP, closing it first if need be.
+    static void openSocket(SOCKET s)
+    {
+        W5100.execCmdSn(s, Sock_CLOSE);
+        W5100.writeSnIR(s, 0xFF);
+        W5100.writeSnMR(s, SnMR::IPRAW);
+        W5100.writeSnPROTO(s, IPPROTO::ICMP);
+        W5100.writeSnPORT(s, 0);
+        W5100.execCmdSn(s, Sock_OPEN);
+        ICMPPING_COUNT(registerReads, 2);
+        ICMPPING_COUNT(registerWrites, 6);
+    }
+
+    static void closeSocket(SOCKET s)
+    {
+        W5100.execCmdSn(s, Sock_CLOSE);
+        W5100.writeSnIR(s, 0xFF);
+        ICMPPING_COUNT(registerReads, 1);
+        ICMPPING_COUNT(registerWrites, 2);
+    }
+
+    static bool socketClosed(SOCKET s)
+    {
+        ICMPPING_COUNT(registerReads, 1);
+        return W5100.readSnSR(s) == SnSR::CLOSED;
+    }
+
+    // route socket s's interrupts to INT, or not.
+    static void enableInterrupt(SOCKET s, bool enable)
+    {
+        uint8_t imr = W5100.readIMR();
+        W5100.writeIMR(enable ? imr | (1 << s) : imr & ~(1 << s));
+        ICMPPING_COUNT(registerReads, 1);
+        ICMPPING_COUNT(registerWrites, 1);
+    }
+
+    static uint8_t readIR(SOCKET s)
+    {
+        ICMPPING_COUNT(registerReads, 1);
+        return W5100.readSnIR(s);
+    }
+
+    static void clearIR(SOCKET s, uint8_t bits)
+    {
+        W5100.writeSnIR(s, bits);
+        ICMPPING_COUNT(registerWrites, 1);
+    }
+
+    /*
+    Send a packet made of header followed by payload to addr, with the
+    given TTL. The two parts are copied into the TX buffer one after the
+    other, so the packet never has to be put together in RAM.
+    */
+    static void send(SOCKET s, const IPAddress& addr, uint8_t ttl,
+                     uint8_t const * header, uint16_t headerSize,
+                     uint8_t const * payload, uint16_t payloadSize)
+    {
+        // I wish there were a better way of doing this, but if we use the uint32_t
+        // cast operator, we're forced to (1) cast away the constness, and (2) deal
+        // with an endianness nightmare.
+        uint8_t addri [] = {addr[0], addr[1], addr[2], addr[3]};
+        W5100.writeSnDIPR(s, addri);
+        W5100.writeSnTTL(s, ttl);
+        // The port isn't used, becuause ICMP is a network-layer protocol. So we
+        // write zero. This probably isn't actually necessary.
+        W5100.writeSnDPORT(s, 0);
+
+        // each of these reads TX_WR, and writes it back after the data.
+        W5100.send_data_processing(s, header, headerSize);
+        if (payloadSize > 0)
+            W5100.send_data_processing(s, payload, payloadSize);
+        W5100.execCmdSn(s, Sock_SEND);
+        ICMPPING_COUNT(registerReads, payloadSize > 0 ? 3 : 2);
+        ICMPPING_COUNT(registerWrites, payloadSize > 0 ? 6 : 5);
+        ICMPPING_COUNT(bytesWritten, headerSize + payloadSize);
+    }
+
+    static uint16_t rxSize(SOCKET s)
+    {
+        // read twice, to make sure it wasn't changing under us.
+        ICMPPING_COUNT(registerReads, 2);
+        return W5100.getRXReceivedSize(s);
+    }
+
+    // where the next datagram starts in the RX buffer.
+    static uint16_t rxPointer(SOCKET s)
+    {
+        ICMPPING_COUNT(registerReads, 1);
+        return W5100.readSnRX_RD(s);
+    }
+
+    // copy len bytes starting at ptr out of the RX buffer, wrapping around
+    // its end if need be.
+    static void read(SOCKET s, uint16_t ptr, uint8_t * buf, uint16_t len)
+    {
+        W5100.read_data(s, ptr, buf, len);
+        ICMPPING_COUNT(bytesRead, len);
+    }
+
+    // hand everything before ptr back to the chip.
+    static void release(SOCKET s, uint16_t ptr)
+    {
+        W5100.writeSnRX_RD(s, ptr);
+        W5100.execCmdSn(s, Sock_RECV);
+        ICMPPING_COUNT(registerReads, 1);
+        ICMPPING_COUNT(registerWrites, 2);
+    }
+
+    // the TTL of the last datagram received.
+    static uint8_t readTTL(SOCKET s)
+    {
+        ICMPPING_COUNT(registerReads, 1);
+        return W5100.readSnTTL(s);
+    }
+
+    // set arrived to the time the datagram at ptr arrived, if known.
+    // The W5100 doesn't keep track, so it's left as when we found it.
+    static void arrivalTime(SOCKET, uint16_t, icmp_time_t&)
+    {
+    }
+};
+
+typedef ICMPPingW5100 ICMPPingChip;
+
+#elif defined(ICMPPING_W5500)
+
+// ICMPPING_W5500_BUFFER_KB -- the W5500 has 16K of socket buffers, which the
+// Ethernet2 library shares out 2K to each of its 8 sockets. Define this to
+// give the ping socket this many K of RX buffer instead (1, 2, 4, 8 or 16), so
+// that more replies can wait in it. The buffers of all the sockets have to
+// add up to 16K or less, so make sure the rest are shrunk to match.
+// #define ICMPPING_W5500_BUFFER_KB 8
+
+// ICMPPING_W5500_SS_PIN -- the W5500's chip select pin, for the SPI frames
+// the library makes itself: packets into and out of the socket buffers, and
+// the registers the Ethernet2 library has no accessors for (the socket
+// interrupt mask, and ICMPPING_W5500_BUFFER_KB).
+#ifndef ICMPPING_W5500_SS_PIN
+#define ICMPPING_W5500_SS_PIN 10
+#endif
+
+struct ICMPPingW5500
+{
+    /*
+    The W5500, through the Ethernet2 library's w5500 object for the socket
+    registers, whose accessors are the calls Ethernet2's own socket code
+    makes. W5500Class keeps its raw read() and write() private, so the
+    socket buffers, and the two registers it has no accessors for, get SPI
+    frames of their own. A W5500 frame moves as many bytes as it likes, so
+    a whole packet goes in or out in one.
+    */
+
+    // SPI control bytes, for the common registers, socket s's registers,
+    // and its TX and RX buffers.
+    static uint8_t commonRead() { return 0x00; }
+    static uint8_t commonWrite() { return 0x04; }
+    static uint8_t registerWrite(SOCKET s) { return 0x0C + (s << 5); }
+    static uint8_t txWrite(SOCKET s) { return 0x14 + (s << 5); }
+    static uint8_t rxRead(SOCKET s) { return 0x18 + (s << 5); }
+
+    // start a frame at addr: a 16 bit address, then the control byte. Every
+    // SPI.transfer() until endFrame() moves a byte to or from the next
+    // address along; the W5500 wraps them around the end of a buffer itself.
+    static void beginFrame(uint16_t addr, uint8_t control)
+    {
+        SPI.beginTransaction(SPISettings(8000000, MSBFIRST, SPI_MODE0));
+        digitalWrite(ICMPPING_W5500_SS_PIN, LOW);
+        SPI.transfer(addr >> 8);
+        SPI.transfer(addr & 0xFF);
+        SPI.transfer(control);
+    }
+
+    static void endFrame()
+    {
+        digitalWrite(ICMPPING_W5500_SS_PIN, HIGH);
+        SPI.endTransaction();
+    }
+
+    // one byte to or from register addr.
+    static uint8_t transfer(uint16_t addr, uint8_t control, uint8_t data)
+    {
+        beginFrame(addr, control);
+        data = SPI.transfer(data);
+        endFrame();
+        return data;
+    }
+
+    static void openSocket(SOCKET s)
+    {
+        w5500.execCmdSn(s, Sock_CLOSE);
+        w5500.writeSnIR(s, 0xFF);
+        w5500.writeSnMR(s, SnMR::IPRAW);
+        w5500.writeSnPROTO(s, IPPROTO::ICMP);
+        w5500.writeSnPORT(s, 0);
+#ifdef ICMPPING_W5500_BUFFER_KB
+        // Sn_RXBUF_SIZE
+        transfer(0x001E, registerWrite(s), ICMPPING_W5500_BUFFER_KB);
+        ICMPPING_COUNT(registerWrites, 1);
+#endif
+        w5500.execCmdSn(s, Sock_OPEN);
+        ICMPPING_COUNT(registerReads, 2);
+        ICMPPING_COUNT(registerWrites, 6);
+    }
+
+    static void closeSocket(SOCKET s)
+    {
+        w5500.execCmdSn(s, Sock_CLOSE);
+        w5500.writeSnIR(s, 0xFF);
+        ICMPPING_COUNT(registerReads, 1);
+        ICMPPING_COUNT(registerWrites, 2);
+    }
+
+    static bool socketClosed(SOCKET s)
+    {
+        ICMPPING_COUNT(registerReads, 1);
+        return w5500.readSnSR(s) == SnSR::CLOSED;
+    }
+
+    static void enableInterrupt(SOCKET s, bool enable)
+    {
+        // the socket interrupts are masked in SIMR, not IMR, on the W5500.
+        uint8_t simr = transfer(0x0018, commonRead(), 0);
+        simr = enable ? simr | (1 << s) : simr & ~(1 << s);
+        transfer(0x0018, commonWrite(), simr);
+        ICMPPING_COUNT(registerReads, 1);
+        ICMPPING_COUNT(registerWrites, 1);
+    }
+
+    static uint8_t readIR(SOCKET s)
+    {
+        ICMPPING_COUNT(registerReads, 1);
+        return w5500.readSnIR(s);
+    }
+
+    static void clearIR(SOCKET s, uint8_t bits)
+    {
+        w5500.writeSnIR(s, bits);
+        ICMPPING_COUNT(registerWrites, 1);
+    }
+
+    static void send(SOCKET s, const IPAddress& addr, uint8_t ttl,
+                     uint8_t const * header, uint16_t headerSize,
+                     uint8_t const * payload, uint16_t payloadSize)
+    {
+        uint8_t addri [] = {addr[0], addr[1], addr[2], addr[3]};
+        w5500.writeSnDIPR(s, addri);
+        w5500.writeSnTTL(s, ttl);
+        w5500.writeSnDPORT(s, 0);
+
+        // header and payload go into the TX buffer in one frame, between a
+        // single read of TX_WR and a single write of it.
+        uint16_t ptr = w5500.readSnTX_WR(s);
+        beginFrame(ptr, txWrite(s));
+        for (uint16_t i = 0; i < headerSize; ++i)
+            SPI.transfer(header[i]);
+        for (uint16_t i = 0; i < payloadSize; ++i)
+            SPI.transfer(payload[i]);
+        endFrame();
+        w5500.writeSnTX_WR(s, ptr + headerSize + payloadSize);
+        w5500.execCmdSn(s, Sock_SEND);
+        ICMPPING_COUNT(registerReads, 2);
+        ICMPPING_COUNT(registerWrites, 5);
+        ICMPPING_COUNT(bytesWritten, headerSize + payloadSize);
+    }
+
+    static uint16_t rxSize(SOCKET s)
+    {
+        ICMPPING_COUNT(registerReads, 2);
+        return w5500.getRXReceivedSize(s);
+    }
+
+    static uint16_t rxPointer(SOCKET s)
+    {
+        ICMPPING_COUNT(registerReads, 1);
+        return w5500.readSnRX_RD(s);
+    }
+
+    static void read(SOCKET s, uint16_t ptr, uint8_t * buf, uint16_t len)
+    {
+        beginFrame(ptr, rxRead(s));
+        for (uint16_t i = 0; i < len; ++i)
+            buf[i] = SPI.transfer(0);
+        endFrame();
+        ICMPPING_COUNT(bytesRead, len);
+    }
+
+    static void release(SOCKET s, uint16_t ptr)
+    {
+        w5500.writeSnRX_RD(s, ptr);
+        w5500.execCmdSn(s, Sock_RECV);
+        ICMPPING_COUNT(registerReads, 1);
+        ICMPPING_COUNT(registerWrites, 2);
+    }
+
+    static uint8_t readTTL(SOCKET s)
+    {
+        ICMPPING_COUNT(registerReads, 1);
+        return w5500.readSnTTL(s);
+    }
+
+    static void arrivalTime(SOCKET, uint16_t, icmp_time_t&)
+    {
+    }
+};
+
+typedef ICMPPingW5500 ICMPPingChip;
+
+#else
+
+// ICMPPING_LINUX_BUFFER -- the size of the RX buffer kept for each socket on
+// Linux, in bytes. Has to be a power of two, from 8K to 32K.
+#ifndef ICMPPING_LINUX_BUFFER
+#define ICMPPING_LINUX_BUFFER 16384
+#endif
+
+struct ICMPPingLinux
+{
+    /*
+    Linux, through the kernel's ICMP sockets: unprivileged datagram sockets
+    where the system allows them (see net.ipv4.ping_group_range), and raw
+    ones, which need root or CAP_NET_RAW, where it doesn't. Each SOCKET
+    number gets a socket of its own, and whatever arrives on it is copied
+    into an RX buffer laid out like the W5100's, so the rest of the library
+    can't tell the difference. Replies are stamped with the time the kernel
+    received them, rather than when we got around to looking. On datagram
+    sockets TIME_EXCEEDED arrives as an error, and is made to look as if it
+    had come in like it would on a raw socket. The functions are in
+    ICMPPingLinux.cpp.
+    */
+
+    static void openSocket(SOCKET s);
+    static void closeSocket(SOCKET s);
+    static bool socketClosed(SOCKET s);
+
+    // there's no INT pin; see wait().
+    static void enableInterrupt(SOCKET, bool)
+    {
+    }
+
+    static uint8_t readIR(SOCKET s);
+    static void clearIR(SOCKET s, uint8_t bits);
+
+    // sent straight away, so SEND_OK (or TIMEOUT, if the kernel refused it)
+    // is set by the time this returns.
+    static void send(SOCKET s, const IPAddress& addr, uint8_t ttl,
+                     uint8_t const * header, uint16_t headerSize,
+                     uint8_t const * payload, uint16_t payloadSize);
+
+    static uint16_t rxSize(SOCKET s);
+    static uint16_t rxPointer(SOCKET s);
+    static void read(SOCKET s, uint16_t ptr, uint8_t * buf, uint16_t len);
+    static void release(SOCKET s, uint16_t ptr);
+    static uint8_t readTTL(SOCKET s);
+    static void arrivalTime(SOCKET s, uint16_t ptr, icmp_time_t& arrived);
+
+    /*
+    Used by ICMPPing instead of spinning. Returns straight away if one of
+    the sockets we're waiting on has something for us, and otherwise sleeps
+    in epoll until something new arrives on any of the open sockets, for at
+    most timeout ms. Whatever is left unread on the other sockets doesn't
+    cut the sleep short, so one that nobody is reading can't keep us awake.
+    @return: Whether there's anything to look at.
+    */
+    static bool wait(const SOCKET * sockets, uint8_t numSockets, uint16_t timeout);
+};
+
+typedef ICMPPingLinux ICMPPingChip;
+
+#endif
+
+#endif
@@ -0,0 +1,479 @@
+/*
+ * Copyright (c) 2010 by Blake Foster <blfoster@vassar.edu>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Implementation of the templates declared in ICMPPing.h. Everything that
+ * doesn't depend on the payload size lives in ICMPPing.cpp.
+ */
+
+#ifndef ICMPPINGIMPL_H
+#define ICMPPINGIMPL_H
+
+
+template <uint16_t PayloadSize>
+uint16_t ICMPEchoT<PayloadSize>::payloadSum(uint8_t const * payload)
+{
+    return _onesSum(payload, PayloadSize);
+}
+
+template <uint16_t PayloadSize>
+ICMPEchoT<PayloadSize>::ICMPEchoT(uint8_t type, uint16_t _id, uint16_t _seq, uint8_t const * _payload)
+: id(_id), seq(_seq), time(millis())
+{
+    memcpy(payload, _payload, PayloadSize);
+    icmpHeader.type = type;
+    icmpHeader.code = 0;
+    icmpHeader.checksum = _checksum(icmpHeader, id, seq, time, payloadSum(payload));
+}
+
+template <uint16_t PayloadSize>
+ICMPEchoT<PayloadSize>::ICMPEchoT(uint8_t type, uint16_t _id, uint16_t _seq, uint8_t const * _payload, uint16_t _payloadSum)
+: id(_id), seq(_seq), time(millis())
+{
+    memcpy(payload, _payload, PayloadSize);
+    icmpHeader.type = type;
+    icmpHeader.code = 0;
+    icmpHeader.checksum = _checksum(icmpHeader, id, seq, time, _payloadSum);
+}
+
+template <uint16_t PayloadSize>
+ICMPEchoT<PayloadSize>::ICMPEchoT()
+: id(0), seq(0), time(0)
+{
+    memset(payload, 0, PayloadSize);
+    icmpHeader.code = 0;
+    icmpHeader.type = 0;
+    icmpHeader.checksum = 0;
+}
+
+template <uint16_t PayloadSize>
+void ICMPEchoT<PayloadSize>::serialize(uint8_t * binData) const
+{
+    *(binData++) = icmpHeader.type;
+    *(binData++) = icmpHeader.code;
+
+    *(binData++) = icmpHeader.checksum >> 8;
+    *(binData++) = icmpHeader.checksum;
+    *(binData++) = id >> 8;
+    *(binData++) = id;
+    *(binData++) = seq >> 8;
+    *(binData++) = seq;
+    *(binData++) = time >> 24;
+    *(binData++) = time >> 16;
+    *(binData++) = time >> 8;
+    *(binData++) = time;
+
+    memcpy(binData, payload, PayloadSize);
+}
+
+template <uint16_t PayloadSize>
+void ICMPEchoT<PayloadSize>::deserialize(uint8_t const * binData)
+{
+    icmpHeader.type = *(binData++);
+    icmpHeader.code = *(binData++);
+
+    icmpHeader.checksum = _makeUint16(binData[0], binData[1]); binData += 2;
+    id                  = _makeUint16(binData[0], binData[1]); binData += 2;
+    seq                 = _makeUint16(binData[0], binData[1]); binData += 2;
+
+    if (icmpHeader.type != TIME_EXCEEDED)
+    {
+        time = ((icmp_time_t)_makeUint16(binData[0], binData[1]) << 16)
+                | _makeUint16(binData[2], binData[3]);
+        binData += 4;
+    }
+
+    memcpy(payload, binData, PayloadSize);
+}
+
+
+template <uint16_t PayloadSize>
+bool ICMPReplyDispatcher::collect(uint16_t id, uint16_t seq, const IPAddress& addr, ICMPEchoReplyT<PayloadSize>& reply)
+{
+    int8_t i = findHeld(id, seq, addr);
+    if (i < 0)
+        return false;
+
+    Held& held = _mailbox[i];
+    reply.data = ICMPEchoT<PayloadSize>();
+    reply.data.icmpHeader.type = held.type;
+    reply.status = SUCCESS; // damaged ones aren't held
+    reply.data.id = id;
+    reply.data.seq = seq;
+    reply.addr = IPAddress(held.from);
+    reply.ttl = held.ttl;
+    // if it was read before the request was sent again, it's for an
+    // earlier try, and there's no telling how long it really took.
+    const Request& request = _requests[held.request];
+    reply.rtt = (int32_t)(held.arrived - request.sent) < 0 ? request.sent : held.arrived;
+    held.request = NO_REQUEST;
+    return true;
+}
+
+
+template <uint16_t PayloadSize>
+bool ICMPPingBase::readEchoReply(SOCKET s, uint16_t id, ICMPEchoReplyT<PayloadSize>& echoReply,
+                                 uint16_t& seq, IPAddress& addr, const ICMPReplyDispatcher * dispatcher)
+{
+    // anything that's in the buffer now arrived before this.
+    icmp_time_t arrived = ICMPPING_RTT_CLOCK();
+    acknowledgeReceive(s);
+    uint16_t size;
+    while ((size = ICMPPingChip::rxSize(s)) > 0)
+    {
+        // Each datagram in the RX buffer is preceded by the source address and
+        // length. Read those, the ICMP header and the 4 bytes after it (the
+        // time, or the start of the IP header that TIME_EXCEEDED quotes) in
+        // one go, straight out of the buffer, and only copy the rest out if
+        // the packet turns out to be ours. Anything past the end of a short
+        // datagram is just ignored.
+        ICMPPING_PROFILE(uint32_t start = micros());
+        uint8_t header[6 + 8 + 4];
+        uint16_t buffer = ICMPPingChip::rxPointer(s);
+        ICMPPingChip::read(s, buffer, header, sizeof(header));
+        buffer += 6;
+        uint16_t dataLen = _makeUint16(header[4], header[5]);
+        uint8_t const * icmpHeader = header + 6;
+        if (size < 6 || dataLen > size - 6)
+        {
+            // a datagram can't be bigger than what's in the buffer, so
+            // we've lost track of where they start (on a W5100, after a
+            // glitch on SPI). Nothing in there can be trusted now, so throw
+            // all of it away.
+            ICMPPingChip::release(s, buffer - 6 + size);
+            ICMPPING_COUNT(foreignPackets, 1);
+            return false;
+        }
+
+        bool ours = false;
+        uint16_t requestId = 0;
+        uint16_t payloadOffset = 8;
+        if (dataLen >= 8 && icmpHeader[0] == ICMP_ECHOREP)
+        {
+            requestId = _makeUint16(icmpHeader[4], icmpHeader[5]);
+            ours = true;
+            seq = _makeUint16(icmpHeader[6], icmpHeader[7]);
+            addr = IPAddress(header);
+            payloadOffset += sizeof(icmp_time_t);
+        }
+        else if (dataLen >= 8 && icmpHeader[0] == TIME_EXCEEDED)
+        {
+            // the router quotes the IP header of our request followed by the
+            // first 8 bytes of the ICMP packet. Make sure all of that fits in
+            // the datagram before we trust it.
+            uint16_t ipHeaderSize = (icmpHeader[8] & 0x0F) * 4u;
+            if (ipHeaderSize >= 20 && 8u + ipHeaderSize + 8u <= dataLen)
+            {
+                // The destination ip address at the end of the originating
+                // packet's IP header, and the ICMP header right after it.
+                uint8_t source[4 + 8];
+                ICMPPingChip::read(s, buffer + 8 + ipHeaderSize - 4, source, sizeof(source));
+                uint8_t const * sourceIcmpHeader = source + 4;
+                requestId = _makeUint16(sourceIcmpHeader[4], sourceIcmpHeader[5]);
+                ours = true;
+                seq = _makeUint16(sourceIcmpHeader[6], sourceIcmpHeader[7]);
+                addr = IPAddress(source);
+            }
+        }
+
+        ours = ours && (requestId == id || (dispatcher && dispatcher->expects(requestId)));
+        if (ours)
+        {
+            for (int i = 0; i < 4; ++i)
+                echoReply.addr[i] = header[i];
+            echoReply.rtt = arrived;
+            ICMPPingChip::arrivalTime(s, buffer - 6, echoReply.rtt);
+
+            echoReply.data.icmpHeader.type = icmpHeader[0];
+            echoReply.data.icmpHeader.code = icmpHeader[1];
+            echoReply.data.icmpHeader.checksum = _makeUint16(icmpHeader[2], icmpHeader[3]);
+            echoReply.data.id = requestId;
+            echoReply.data.seq = seq;
+
+            if (payloadOffset > 8 && dataLen >= payloadOffset)
+            {
+                uint8_t const * time = icmpHeader + 8;
+                echoReply.data.time = ((icmp_time_t)_makeUint16(time[0], time[1]) << 16)
+                        | _makeUint16(time[2], time[3]);
+            }
+
+            uint16_t payloadLen = dataLen > payloadOffset ? dataLen - payloadOffset : 0;
+            if (payloadLen > PayloadSize)
+                payloadLen = PayloadSize;
+            ICMPPingChip::read(s, buffer + payloadOffset, echoReply.data.payload, payloadLen);
+
+            // the checksum covers the whole packet. Sum the header and the
+            // payload from what we've already read, and only go back to the
+            // RX buffer for whatever's left, like the rest of the request
+            // that TIME_EXCEEDED quotes.
+            uint16_t summed = dataLen < 12 ? dataLen : 12;
+            unsigned long sum = _onesSum(icmpHeader, summed);
+            // (an echo reply too short to have a time has no payload either.)
+            if (payloadLen > 0 && payloadOffset + payloadLen > summed)
+            {
+                uint16_t n = (payloadOffset + payloadLen - summed) & ~1;
+                sum += _onesSum(echoReply.data.payload + (summed - payloadOffset), n);
+                summed += n;
+            }
+            if (dataLen > summed)
+                sum += receivedSum(s, buffer + summed, dataLen - summed);
+            echoReply.status = _foldSum(sum) == 0xFFFF ? SUCCESS : BAD_CHECKSUM;
+        }
+
+        // skip the whole datagram, however much of it we actually read.
+        buffer += dataLen;
+        ICMPPingChip::release(s, buffer);
+
+        if (ours)
+        {
+            echoReply.ttl = ICMPPingChip::readTTL(s);
+            ICMPPING_COUNT(readTime, micros() - start);
+            return true;
+        }
+        ICMPPING_COUNT(foreignPackets, 1);
+        ICMPPING_COUNT(readTime, micros() - start);
+    }
+    return false;
+}
+
+
+template <uint16_t PayloadSize>
+ICMPPingT<PayloadSize>::ICMPPingT(SOCKET socket, uint16_t id) :
+  ICMPPingBase(socket, id)
+{
+    memset(_payload, 0x1A, PayloadSize);
+    _payloadSum = ICMPEchoT<PayloadSize>::payloadSum(_payload);
+}
+
+
+template <uint16_t PayloadSize>
+void ICMPPingT<PayloadSize>::setPayload(uint8_t const * payload)
+{
+	memcpy(_payload, payload, PayloadSize);
+	_payloadSum = ICMPEchoT<PayloadSize>::payloadSum(_payload);
+}
+
+template <uint16_t PayloadSize>
+void ICMPPingT<PayloadSize>::operator()(const IPAddress& addr, int nRetries, ICMPEchoReplyT<PayloadSize>& result)
+{
+	prepareSocket();
+
+    uint16_t seq = _nextSeq++;
+    result.rtt = 0;
+
+    for (_attempt=0; _attempt<nRetries; ++_attempt)
+    {
+
+    	ICMPPING_DOYIELD();
+
+        waitForPacer(addr);
+        result.status = sendEchoRequest(_socket, addr, _id, seq, _payload, PayloadSize, _payloadSum);
+        if (result.status == SUCCESS)
+        {
+            icmp_time_t sent = ICMPPING_RTT_CLOCK();
+            if (_dispatcher)
+                _dispatcher->sent(_id, seq, addr, sent);
+        	ICMPPING_DOYIELD();
+            receiveEchoReply(_id, seq, addr, sent, result);
+            updateTimeout(_estimator, result.status, result.rtt, _attempt + 1);
+        }
+        if (result.status == SUCCESS)
+        {
+            break;
+        }
+    }
+    if (_dispatcher)
+        _dispatcher->finished(_id, seq, addr, result.status);
+   
+    releaseSocket();
+}
+
+template <uint16_t PayloadSize>
+ICMPEchoReplyT<PayloadSize> ICMPPingT<PayloadSize>::operator()(const IPAddress& addr, int nRetries)
+{
+    ICMPEchoReplyT<PayloadSize> reply;
+    operator()(addr, nRetries, reply);
+    return reply;
+}
+
+template <uint16_t PayloadSize>
+void ICMPPingT<PayloadSize>::receiveEchoReply(uint16_t id, uint16_t seq, const IPAddress& addr, icmp_time_t sent,
+                                              ICMPEchoReplyT<PayloadSize>& echoReply)
+{
+    icmp_time_t timeout = replyTimeout(_estimator);
+    // the time spent reading replies is counted by readEchoReply(), so
+    // count everything else as waiting.
+    ICMPPING_PROFILE(uint32_t start = micros(); uint32_t readTime = _pingProfile.readTime);
+    // whether to look in the RX buffer: with interrupts, only once INT tells
+    // us something arrived, or while we're still working through a backlog.
+    bool poll = true;
+    while (ICMPPING_RTT_CLOCK() - sent < timeout)
+    {
+        // another object sharing the socket may have read it for us.
+        if (_dispatcher && _dispatcher->collect(id, seq, addr, echoReply))
+        {
+            noteReply(id, seq, echoReply.data.icmpHeader.type, echoReply.status);
+        }
+        else
+        {
+            uint16_t requestSeq;
+            IPAddress requestAddr;
+            if (checkInterrupt(_socket))
+                poll = true;
+            if (!poll || !readEchoReply(_socket, id, echoReply, requestSeq, requestAddr, _dispatcher))
+            {
+            	// take a break, maybe let platform do
+            	// some background work (like on ESP8266)
+            	poll = false;
+            	ICMPPING_DOYIELD();
+            	continue;
+            }
+            noteReply(echoReply.data.id, requestSeq, echoReply.data.icmpHeader.type, echoReply.status);
+
+            // ah! we did receive something... check it out.
+            if (echoReply.data.id != id || requestSeq != seq || !(requestAddr == addr))
+            {
+                ICMPPING_COUNT(staleReplies, 1);
+                if (_dispatcher)
+                    _dispatcher->dispatch(echoReply, requestSeq, requestAddr);
+                continue;
+            }
+        }
+
+        if (echoReply.status == SUCCESS && echoReply.data.icmpHeader.type != ICMP_ECHOREP)
+            echoReply.status = BAD_RESPONSE;
+        echoReply.rtt = _elapsed(sent, echoReply.rtt);
+        ICMPPING_COUNT(waitTime, micros() - start - (_pingProfile.readTime - readTime));
+        return;
+    }
+    echoReply.status = NO_RESPONSE;
+    echoReply.rtt = 0;
+    ICMPPING_COUNT(waitTime, micros() - start - (_pingProfile.readTime - readTime));
+}
+
+
+
+#ifdef ICMPPING_ASYNCH_ENABLE
+/*
+ * When ICMPPING_ASYNCH_ENABLE is defined, we have access to the
+ * asyncStart()/asyncComplete() methods from the API.
+ */
+template <uint16_t PayloadSize>
+bool ICMPPingT<PayloadSize>::asyncSend(ICMPEchoReplyT<PayloadSize>& result)
+{
+    Status sendOpResult(NO_RESPONSE);
+    bool sendSuccess = false;
+    for (uint8_t i=_attempt; i<_numRetries; ++i)
+    {
+    	_attempt++;
+
+    	ICMPPING_DOYIELD();
+    	waitForPacer(_addr);
+    	sendOpResult = sendEchoRequest(_socket, _addr, _id, _curSeq, _payload, PayloadSize, _payloadSum);
+    	if (sendOpResult == SUCCESS)
+    	{
+    		sendSuccess = true; // it worked
+    		sendOpResult = ASYNC_SENT; // we're doing this async-style, force the status
+    		_asyncsent = ICMPPING_RTT_CLOCK(); // not the start time, for timeouts
+    		if (_dispatcher)
+    			_dispatcher->sent(_id, _curSeq, _addr, _asyncsent);
+    		break; // break out of this loop, 'cause we're done.
+
+    	}
+    }
+    _asyncstatus = sendOpResult; // keep track of this, in case the ICMPEchoReply isn't re-used
+    result.status = _asyncstatus; // set the result, in case the ICMPEchoReply is checked
+    return sendSuccess; // return success of send op
+}
+
+template <uint16_t PayloadSize>
+bool ICMPPingT<PayloadSize>::asyncStart(const IPAddress& addr, int nRetries, ICMPEchoReplyT<PayloadSize>& result)
+{
+	prepareSocket();
+
+	// stash our state, so we can access
+	// in asynchSend()/asyncComplete()
+	_numRetries = nRetries;
+	_attempt = 0;
+	_curSeq = _nextSeq++;
+	_addr = addr;
+	result.rtt = 0;
+
+	return asyncSend(result);
+
+}
+
+template <uint16_t PayloadSize>
+bool ICMPPingT<PayloadSize>::asyncComplete(ICMPEchoReplyT<PayloadSize>& result)
+{
+
+	if (_asyncstatus != ASYNC_SENT)
+	{
+		// we either:
+		//  - didn't start an async request;
+		//	- failed to send; or
+		//	- are no longer waiting on this packet.
+		// either way, we're done
+		return true;
+	}
+
+
+	if ((_dispatcher && _dispatcher->holds(_id, _curSeq, _addr))
+			|| (checkInterrupt(_socket) && ICMPPingChip::rxSize(_socket)))
+	{
+		// ooooh, we've got a pending reply
+		receiveEchoReply(_id, _curSeq, _addr, _asyncsent, result);
+		updateTimeout(_estimator, result.status, result.rtt, _attempt);
+		_asyncstatus = result.status; // make note of this status, whatever it is.
+		if (_dispatcher)
+			_dispatcher->finished(_id, _curSeq, _addr, result.status);
+		return true; // whatever the result of the receiveEchoReply(), the async op is done.
+	}
+
+	// nothing yet... check if we've timed out
+	if ( (ICMPPING_RTT_CLOCK() - _asyncsent) > replyTimeout(_estimator))
+	{
+		updateTimeout(_estimator, NO_RESPONSE, 0, _attempt);
+
+		// yep, we've timed out...
+		if (_attempt < _numRetries)
+		{
+			// still, this wasn't our last attempt, let's try again
+			if (asyncSend(result))
+			{
+				// another send has succeeded
+				// we'll wait for that now...
+				return false;
+			}
+
+			// this send has failed. too bad,
+			// we are done.
+			if (_dispatcher)
+				_dispatcher->finished(_id, _curSeq, _addr, NO_RESPONSE);
+			return true;
+		}
+
+		// we timed out and have no more attempts left...
+		// hello?  is anybody out there?
+		// guess not:
+	    result.status = NO_RESPONSE;
+	    result.rtt = 0;
+	    if (_dispatcher)
+	    	_dispatcher->finished(_id, _curSeq, _addr, NO_RESPONSE);
+	    return true;
+	}
+
+	// have yet to time out, will wait some more:
+	return false; // results still not in
+
+}
+
+#endif	/* ICMPPING_ASYNCH_ENABLE */
+
+#endif
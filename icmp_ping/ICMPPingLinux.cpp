@@ -0,0 +1,520 @@
+/*
+ * Copyright (c) 2010 by Blake Foster <blfoster@vassar.edu>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * The ICMPPingLinux functions declared in ICMPPingChip.h. Only built when
+ * ICMPPING_LINUX is defined.
+ */
+
+#ifdef ICMPPING_LINUX
+
+// before ICMPPing.h, which leaves #pragma pack(1) on.
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "ICMPPing.h"
+
+// the most datagrams that can wait in a socket's RX buffer at once.
+#define MAX_DATAGRAMS 256
+
+// big enough for anything that will fit in the RX buffer with its header.
+#define MAX_DATAGRAM_SIZE 4096
+
+// the number of requests sent on a datagram socket whose ids we remember,
+// for the replies.
+#define MAX_REQUESTS 1024
+
+#if ICMPPING_LINUX_BUFFER < 2 * MAX_DATAGRAM_SIZE
+#error "ICMPPING_LINUX_BUFFER must be at least 8K."
+#endif
+
+// what we ask the kernel to queue for each socket before it starts dropping
+// replies. The default holds only a couple of hundred, which a scheduler
+// with a big ICMPPING_MAX_PENDING can have in flight on one socket.
+#define KERNEL_BUFFER (4 * 1024 * 1024)
+
+struct Datagram
+{
+    /*
+    What we know about a datagram in the RX buffer that the W5100 wouldn't
+    tell us.
+    */
+    uint16_t start; // where its header starts in the RX buffer
+    uint8_t ttl;
+    icmp_time_t arrived; // ICMPPING_RTT_CLOCK() time
+};
+
+struct Request
+{
+    /*
+    A request sent on a datagram socket, and the id it would have gone out
+    with if the kernel hadn't put its own in.
+    */
+    uint8_t addr[4];
+    uint16_t seq;
+    uint16_t id;
+};
+
+struct LinuxSocket
+{
+    int fd; // plus one, so that zero means closed
+    bool raw;
+    bool bound; // whether we've asked for a port yet
+    uint8_t ir;
+    uint8_t ttl; // what IP_TTL is set to
+
+    // the last MAX_REQUESTS requests, oldest first from nextRequest.
+    Request requests[MAX_REQUESTS];
+    uint16_t nextRequest;
+    uint16_t numRequests;
+
+    // laid out as the W5100 lays out its RX buffer: each datagram is
+    // preceded by the source address and its length.
+    uint8_t rx[ICMPPING_LINUX_BUFFER];
+    uint16_t rxRead;
+    uint16_t rxWrite;
+
+    Datagram datagrams[MAX_DATAGRAMS];
+    uint16_t firstDatagram;
+    uint16_t numDatagrams;
+    uint8_t lastTtl; // of the last datagram released
+};
+
+static LinuxSocket sockets[MAX_SOCK_NUM];
+static int epollFd = -1;
+
+
+static uint16_t rxFree(const LinuxSocket& sock)
+{
+    return ICMPPING_LINUX_BUFFER - (uint16_t)(sock.rxWrite - sock.rxRead);
+}
+
+static void rxWrite(LinuxSocket& sock, uint8_t const * data, uint16_t len)
+{
+    for (uint16_t i = 0; i < len; ++i)
+    {
+        sock.rx[(uint16_t)(sock.rxWrite + i) & (ICMPPING_LINUX_BUFFER - 1)] = data[i];
+    }
+    sock.rxWrite += len;
+}
+
+// the ICMPPING_RTT_CLOCK() time at which the kernel stamped a datagram.
+static icmp_time_t arrivalClock(const timespec& stamp)
+{
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    icmp_time_t clock = ICMPPING_RTT_CLOCK();
+    long long age = (now.tv_sec - stamp.tv_sec) * 1000000000LL + (now.tv_nsec - stamp.tv_nsec);
+    if (age < 0)
+        return clock;
+    return clock - (icmp_time_t)(age / (1000000 / ICMPPING_RTT_PER_MS));
+}
+
+/*
+Copies one datagram into sock's RX buffer, with the header in front.
+@param icmp: The ICMP packet, not including the IP header.
+*/
+static void queueDatagram(LinuxSocket& sock, const uint8_t * source, uint8_t const * icmp, uint16_t len,
+                          uint8_t ttl, icmp_time_t arrived)
+{
+    if (sock.numDatagrams == MAX_DATAGRAMS || rxFree(sock) < 6 + len)
+        return; // full, so it's dropped, as it would be by the W5100.
+
+    Datagram& datagram = sock.datagrams[(sock.firstDatagram + sock.numDatagrams++) % MAX_DATAGRAMS];
+    datagram.start = sock.rxWrite;
+    datagram.ttl = ttl;
+    datagram.arrived = arrived;
+
+    uint8_t header[6] = {source[0], source[1], source[2], source[3], (uint8_t)(len >> 8), (uint8_t)len};
+    rxWrite(sock, header, sizeof(header));
+    rxWrite(sock, icmp, len);
+}
+
+/*
+Finds the id that the request to addr with the given seq went out with, if
+we still remember it.
+@param id: Left alone if we don't.
+*/
+static void requestId(const LinuxSocket& sock, const uint8_t * addr, uint16_t seq, uint16_t& id)
+{
+    // newest first, since that's where the reply to a request still in
+    // flight usually is.
+    for (uint16_t n = 1; n <= sock.numRequests; ++n)
+    {
+        const Request& request = sock.requests[(sock.nextRequest + MAX_REQUESTS - n) % MAX_REQUESTS];
+        if (request.seq == seq && memcmp(request.addr, addr, 4) == 0)
+        {
+            id = request.id;
+            return;
+        }
+    }
+}
+
+// puts id in place of the ICMP header's, and fixes the checksum to match
+// (RFC 1624).
+static void replaceId(uint8_t * icmp, uint16_t id)
+{
+    unsigned long sum = (uint16_t)~_makeUint16(icmp[2], icmp[3]);
+    sum += (uint16_t)~_makeUint16(icmp[4], icmp[5]);
+    sum += id;
+    uint16_t checksum = ~_foldSum(sum);
+    icmp[2] = checksum >> 8;
+    icmp[3] = checksum;
+    icmp[4] = id >> 8;
+    icmp[5] = id;
+}
+
+/*
+Turns an error from a datagram socket's error queue into the TIME_EXCEEDED
+(or other ICMP error) that a raw socket would have seen: the ICMP header,
+then an IP header with the destination of the original request, then the
+first 8 bytes of the request, which is what the kernel gives back.
+*/
+static void queueError(LinuxSocket& sock, const sock_extended_err& err, const sockaddr_in& dest,
+                       uint8_t const * request, uint16_t requestLen, icmp_time_t arrived)
+{
+    if (err.ee_origin != SO_EE_ORIGIN_ICMP || requestLen < 8)
+        return;
+    const sockaddr_in * offender = (const sockaddr_in *)SO_EE_OFFENDER(&err);
+
+    uint8_t packet[8 + 20 + 8];
+    memset(packet, 0, sizeof(packet));
+    packet[0] = err.ee_type;
+    packet[1] = err.ee_code;
+    uint8_t * ip = packet + 8;
+    ip[0] = 0x45;
+    memcpy(ip + 16, &dest.sin_addr, 4);
+    memcpy(ip + 20, request, 8);
+    // the kernel put its own id in the request, so put ours back.
+    uint16_t id = _makeUint16(request[4], request[5]);
+    requestId(sock, (const uint8_t *)&dest.sin_addr, _makeUint16(request[6], request[7]), id);
+    ip[24] = id >> 8;
+    ip[25] = id;
+    uint16_t sum = ~_onesSum(packet, sizeof(packet));
+    packet[2] = sum >> 8;
+    packet[3] = sum;
+
+    queueDatagram(sock, (const uint8_t *)&offender->sin_addr, packet, sizeof(packet), 0, arrived);
+}
+
+// copies whatever the kernel has for sock into its RX buffer.
+static void pump(LinuxSocket& sock)
+{
+    uint8_t buffer[MAX_DATAGRAM_SIZE];
+    char control[512];
+
+    for (int queue = 0; queue < 2; ++queue)
+    {
+        int flags = MSG_DONTWAIT | (queue ? MSG_ERRQUEUE : 0);
+        // stop while there's still room for the biggest datagram, rather
+        // than take one out of the kernel only to find it doesn't fit.
+        while (sock.numDatagrams < MAX_DATAGRAMS && rxFree(sock) >= 6 + MAX_DATAGRAM_SIZE)
+        {
+            sockaddr_in from;
+            iovec iov = {buffer, sizeof(buffer)};
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_name = &from;
+            msg.msg_namelen = sizeof(from);
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            ssize_t len = recvmsg(sock.fd - 1, &msg, flags);
+            if (len < 0)
+                break;
+
+            icmp_time_t arrived = ICMPPING_RTT_CLOCK();
+            uint8_t ttl = 0;
+            const sock_extended_err * err = NULL;
+            for (cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+            {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+                    arrived = arrivalClock(*(const timespec *)CMSG_DATA(cmsg));
+                else if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_TTL)
+                    ttl = *(const int *)CMSG_DATA(cmsg);
+                else if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR)
+                    err = (const sock_extended_err *)CMSG_DATA(cmsg);
+            }
+
+            if (queue)
+            {
+                if (err)
+                    queueError(sock, *err, from, buffer, len, arrived);
+                continue;
+            }
+
+            uint8_t * icmp = buffer;
+            const uint8_t * source = (const uint8_t *)&from.sin_addr;
+            if (sock.raw)
+            {
+                // raw sockets get the IP header too.
+                uint16_t ipHeaderSize = (buffer[0] & 0x0F) * 4u;
+                if (len < ipHeaderSize)
+                    continue;
+                ttl = buffer[8];
+                source = buffer + 12;
+                icmp = buffer + ipHeaderSize;
+                len -= ipHeaderSize;
+            }
+            else if (len >= 8 && icmp[0] == ICMP_ECHOREP)
+            {
+                // the kernel put its own id in the request, so put back the
+                // one it was sent with. The seq and address tell us which
+                // request it was, since all of a socket's requests go out
+                // with the same id, however many objects share it.
+                uint16_t kernelId = _makeUint16(icmp[4], icmp[5]);
+                uint16_t id = kernelId;
+                requestId(sock, source, _makeUint16(icmp[6], icmp[7]), id);
+                if (id != kernelId)
+                    replaceId(icmp, id);
+            }
+
+            queueDatagram(sock, source, icmp, len, ttl, arrived);
+        }
+    }
+}
+
+
+void ICMPPingLinux::openSocket(SOCKET s)
+{
+    closeSocket(s);
+    LinuxSocket& sock = sockets[s];
+
+    // unprivileged ping sockets if we're allowed them, raw ones if not.
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_ICMP);
+    sock.raw = fd < 0;
+    if (fd < 0)
+        fd = socket(AF_INET, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_ICMP);
+    if (fd < 0)
+        return;
+
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    // past net.core.rmem_max only with CAP_NET_ADMIN; otherwise as close
+    // to it as we're allowed.
+    int size = KERNEL_BUFFER;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    if (!sock.raw)
+    {
+        setsockopt(fd, IPPROTO_IP, IP_RECVTTL, &on, sizeof(on));
+        setsockopt(fd, IPPROTO_IP, IP_RECVERR, &on, sizeof(on));
+    }
+
+    if (epollFd < 0)
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+    // edge triggered, so that wait() only wakes up for new arrivals.
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLET;
+    event.data.u32 = s;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+
+    sock.fd = fd + 1;
+    sock.ir = 0;
+    sock.bound = false;
+    sock.ttl = 0;
+    sock.nextRequest = 0;
+    sock.numRequests = 0;
+    sock.rxRead = 0;
+    sock.rxWrite = 0;
+    sock.firstDatagram = 0;
+    sock.numDatagrams = 0;
+    sock.lastTtl = 0;
+}
+
+void ICMPPingLinux::closeSocket(SOCKET s)
+{
+    LinuxSocket& sock = sockets[s];
+    if (sock.fd)
+        close(sock.fd - 1);
+    sock.fd = 0;
+}
+
+bool ICMPPingLinux::socketClosed(SOCKET s)
+{
+    return sockets[s].fd == 0;
+}
+
+uint8_t ICMPPingLinux::readIR(SOCKET s)
+{
+    return sockets[s].ir;
+}
+
+void ICMPPingLinux::clearIR(SOCKET s, uint8_t bits)
+{
+    sockets[s].ir &= ~bits;
+}
+
+void ICMPPingLinux::send(SOCKET s, const IPAddress& addr, uint8_t ttl,
+                         uint8_t const * header, uint16_t headerSize,
+                         uint8_t const * payload, uint16_t payloadSize)
+{
+    LinuxSocket& sock = sockets[s];
+    if (!sock.fd)
+    {
+        sock.ir |= SnIR::TIMEOUT;
+        return;
+    }
+    int fd = sock.fd - 1;
+
+    uint16_t id = _makeUint16(header[4], header[5]);
+    if (!sock.raw)
+    {
+        if (!sock.bound)
+        {
+            // a ping socket's port is the id of all of its requests, so ask
+            // for the first one's. If it's taken the kernel picks its own.
+            sockaddr_in local;
+            memset(&local, 0, sizeof(local));
+            local.sin_family = AF_INET;
+            local.sin_port = htons(id);
+            bind(fd, (const sockaddr *)&local, sizeof(local));
+            sock.bound = true;
+        }
+
+        // so that pump() can put the id back in the reply.
+        Request& request = sock.requests[sock.nextRequest];
+        for (int i = 0; i < 4; ++i)
+            request.addr[i] = addr[i];
+        request.seq = _makeUint16(header[6], header[7]);
+        request.id = id;
+        sock.nextRequest = (sock.nextRequest + 1) % MAX_REQUESTS;
+        if (sock.numRequests < MAX_REQUESTS)
+            ++sock.numRequests;
+    }
+
+    if (ttl != sock.ttl)
+    {
+        int value = ttl;
+        setsockopt(fd, IPPROTO_IP, IP_TTL, &value, sizeof(value));
+        sock.ttl = ttl;
+    }
+
+    sockaddr_in to;
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    uint8_t * toAddr = (uint8_t *)&to.sin_addr;
+    for (int i = 0; i < 4; ++i)
+        toAddr[i] = addr[i];
+
+    // the header and payload go out as they are, without being put
+    // together first.
+    iovec iov[2] = {{(void *)header, headerSize}, {(void *)payload, payloadSize}};
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &to;
+    msg.msg_namelen = sizeof(to);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = payloadSize > 0 ? 2 : 1;
+
+    // the error behind a TIME_EXCEEDED we've been sent is also handed back
+    // by the next send, which goes nowhere, so that one's tried again.
+    int sent = sendmsg(fd, &msg, 0);
+    if (sent < 0 && !sock.raw && errno != EAGAIN)
+        sent = sendmsg(fd, &msg, 0);
+    if (sent < 0)
+        sock.ir |= SnIR::TIMEOUT;
+    else
+        sock.ir |= SnIR::SEND_OK;
+    ICMPPING_COUNT(bytesWritten, headerSize + payloadSize);
+}
+
+uint16_t ICMPPingLinux::rxSize(SOCKET s)
+{
+    LinuxSocket& sock = sockets[s];
+    if (sock.fd)
+        pump(sock);
+    return sock.rxWrite - sock.rxRead;
+}
+
+uint16_t ICMPPingLinux::rxPointer(SOCKET s)
+{
+    return sockets[s].rxRead;
+}
+
+void ICMPPingLinux::read(SOCKET s, uint16_t ptr, uint8_t * buf, uint16_t len)
+{
+    LinuxSocket& sock = sockets[s];
+    for (uint16_t i = 0; i < len; ++i)
+    {
+        buf[i] = sock.rx[(uint16_t)(ptr + i) & (ICMPPING_LINUX_BUFFER - 1)];
+    }
+    ICMPPING_COUNT(bytesRead, len);
+}
+
+void ICMPPingLinux::release(SOCKET s, uint16_t ptr)
+{
+    LinuxSocket& sock = sockets[s];
+    // forget the datagrams that have gone.
+    while (sock.numDatagrams > 0)
+    {
+        const Datagram& datagram = sock.datagrams[sock.firstDatagram];
+        if ((uint16_t)(datagram.start - sock.rxRead) >= (uint16_t)(ptr - sock.rxRead))
+            break;
+        sock.lastTtl = datagram.ttl;
+        sock.firstDatagram = (sock.firstDatagram + 1) % MAX_DATAGRAMS;
+        --sock.numDatagrams;
+    }
+    sock.rxRead = ptr;
+}
+
+uint8_t ICMPPingLinux::readTTL(SOCKET s)
+{
+    return sockets[s].lastTtl;
+}
+
+void ICMPPingLinux::arrivalTime(SOCKET s, uint16_t ptr, icmp_time_t& arrived)
+{
+    const LinuxSocket& sock = sockets[s];
+    for (uint16_t i = 0; i < sock.numDatagrams; ++i)
+    {
+        const Datagram& datagram = sock.datagrams[(sock.firstDatagram + i) % MAX_DATAGRAMS];
+        if (datagram.start == ptr)
+        {
+            arrived = datagram.arrived;
+            return;
+        }
+    }
+}
+
+bool ICMPPingLinux::wait(const SOCKET * waiting, uint8_t numWaiting, uint16_t timeout)
+{
+    // like INT staying low, but only for the sockets the caller cares about.
+    // Looking in the kernel too catches anything whose epoll event was
+    // taken by someone waiting on another socket.
+    for (uint8_t i = 0; i < numWaiting; ++i)
+    {
+        LinuxSocket& sock = sockets[waiting[i]];
+        if (!sock.fd)
+            continue;
+        if (!sock.ir && sock.rxWrite == sock.rxRead)
+            pump(sock);
+        if (sock.ir || sock.rxWrite != sock.rxRead)
+            return true;
+    }
+    if (epollFd < 0)
+    {
+        delay(timeout);
+        return false;
+    }
+
+    epoll_event events[MAX_SOCK_NUM];
+    int n = epoll_wait(epollFd, events, MAX_SOCK_NUM, timeout);
+    return n > 0;
+}
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2010 by Blake Foster <blfoster@vassar.edu>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Just enough of the Arduino core for the library to build on Linux, when
+ * ICMPPING_LINUX is defined. The sockets themselves are in ICMPPingChip.h
+ * and ICMPPingLinux.cpp. Build all of the library's .cpp files along with
+ * your own, with ICMPPING_LINUX defined and the library's directory in the
+ * include path. See extras/linux/ping.cpp for an example.
+ */
+
+#ifndef ICMPPINGLINUX_H
+#define ICMPPINGLINUX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef ICMPPING_INTERRUPTS_ENABLE
+#error "ICMPPING_INTERRUPTS_ENABLE is for the W5100's INT pin; on Linux, waiting is always done with epoll."
+#endif
+
+typedef uint8_t byte;
+typedef uint8_t SOCKET;
+
+// the number of sockets, like MAX_SOCK_NUM on a W5100. ICMPPingPool uses all
+// of them.
+#ifndef MAX_SOCK_NUM
+#define MAX_SOCK_NUM 8
+#endif
+#if MAX_SOCK_NUM > 255
+#error "MAX_SOCK_NUM must fit in a SOCKET."
+#endif
+
+// 32 bits, like the Arduino versions, so that they wrap around the same way.
+inline uint32_t micros()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)now.tv_sec * 1000000UL + now.tv_nsec / 1000;
+}
+
+inline uint32_t millis()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)now.tv_sec * 1000UL + now.tv_nsec / 1000000;
+}
+
+inline void delay(unsigned long ms)
+{
+    timespec wait = {(time_t)(ms / 1000), (long)(ms % 1000) * 1000000L};
+    nanosleep(&wait, NULL);
+}
+
+
+class IPAddress
+{
+public:
+    IPAddress() { memset(_address, 0, sizeof(_address)); }
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+    {
+        _address[0] = a;
+        _address[1] = b;
+        _address[2] = c;
+        _address[3] = d;
+    }
+    IPAddress(const uint8_t * address) { memcpy(_address, address, sizeof(_address)); }
+
+    uint8_t operator[](int i) const { return _address[i]; }
+    uint8_t& operator[](int i) { return _address[i]; }
+
+    bool operator==(const IPAddress& addr) const { return memcmp(_address, addr._address, sizeof(_address)) == 0; }
+    bool operator==(const uint8_t * addr) const { return memcmp(_address, addr, sizeof(_address)) == 0; }
+    bool operator!=(const IPAddress& addr) const { return !(*this == addr); }
+
+private:
+    uint8_t _address[4];
+};
+
+
+class Print
+{
+    /*
+    Somewhere to write bytes to, for ICMPPingLog::exportTo(). Derive from it
+    to write to a file, a socket, or whatever.
+    */
+
+public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t b) = 0;
+
+    virtual size_t write(const uint8_t * buffer, size_t size)
+    {
+        size_t n = 0;
+        while (n < size && write(buffer[n]))
+            ++n;
+        return n;
+    }
+};
+
+
+// the socket interrupt bits that the library looks at.
+class SnIR
+{
+public:
+    static const uint8_t SEND_OK = 0x10;
+    static const uint8_t TIMEOUT = 0x08;
+    static const uint8_t RECV = 0x04;
+};
+
+#endif
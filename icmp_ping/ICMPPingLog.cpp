@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2010 by Blake Foster <blfoster@vassar.edu>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+#include "ICMPPingLog.h"
+
+// the size of a record in the export.
+#define RECORD_SIZE 10
+
+// the number of records to put together before each write to the stream.
+#define RECORDS_PER_WRITE 6
+
+static uint8_t * putUint16(uint8_t * out, uint16_t value)
+{
+    *(out++) = value >> 8;
+    *(out++) = value;
+    return out;
+}
+
+static uint8_t * putUint32(uint8_t * out, uint32_t value)
+{
+    out = putUint16(out, value >> 16);
+    return putUint16(out, value);
+}
+
+ICMPPingLog::ICMPPingLog(ICMPPingRecord * records, uint16_t capacity) :
+  _records(records), _capacity(capacity), _first(0), _size(0), _total(0)
+{
+}
+
+void ICMPPingLog::add(uint16_t target, uint16_t seq, Status status, icmp_time_t rtt, uint8_t ttl)
+{
+    if (_capacity == 0)
+        return;
+
+    uint16_t i = _first + _size;
+    if (i >= _capacity)
+        i -= _capacity;
+    if (_size < _capacity)
+    {
+        ++_size;
+    }
+    else if (++_first == _capacity)
+    {
+        // full, so the new one goes where the oldest was.
+        _first = 0;
+    }
+
+    ICMPPingRecord& record = _records[i];
+    record.target = target;
+    record.seq = seq;
+    record.rtt = rtt;
+    record.status = status;
+    record.ttl = ttl;
+    ++_total;
+}
+
+void ICMPPingLog::clear()
+{
+    _first = 0;
+    _size = 0;
+}
+
+const ICMPPingRecord& ICMPPingLog::operator[](uint16_t i) const
+{
+    i += _first;
+    if (i >= _capacity)
+        i -= _capacity;
+    return _records[i];
+}
+
+uint16_t ICMPPingLog::exportTo(Print& stream, bool clear)
+{
+    uint8_t buffer[RECORDS_PER_WRITE * RECORD_SIZE];
+
+    uint8_t * out = buffer;
+    *(out++) = 'I';
+    *(out++) = 'P';
+    *(out++) = 'L';
+    *(out++) = ICMPPING_LOG_VERSION;
+#ifdef ICMPPING_MICROS_ENABLE
+    *(out++) = 1;
+#else
+    *(out++) = 0;
+#endif
+    *(out++) = RECORD_SIZE;
+    out = putUint16(out, _size);
+    out = putUint32(out, _total - _size);
+    out = putUint32(out, millis());
+    stream.write(buffer, out - buffer);
+
+    // a few records at a time, so that the stream isn't called for every
+    // byte, but without a buffer for the whole lot.
+    out = buffer;
+    for (uint16_t i = 0; i < _size; ++i)
+    {
+        const ICMPPingRecord& record = (*this)[i];
+        out = putUint16(out, record.target);
+        out = putUint16(out, record.seq);
+        out = putUint32(out, record.rtt);
+        *(out++) = record.status;
+        *(out++) = record.ttl;
+        if (out == buffer + sizeof(buffer) || i + 1 == _size)
+        {
+            stream.write(buffer, out - buffer);
+            out = buffer;
+        }
+    }
+
+    uint16_t size = _size;
+    if (clear)
+        this->clear();
+    return size;
+}
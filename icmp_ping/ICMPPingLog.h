@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2010 by Blake Foster <blfoster@vassar.edu>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef ICMPPINGLOG_H
+#define ICMPPINGLOG_H
+
+#include "ICMPPing.h"
+
+// the version of the format written by ICMPPingLog::exportTo().
+#define ICMPPING_LOG_VERSION 1
+
+
+// packed whatever was included before, so that a record is 10 bytes on
+// every board; the export is written field by field, so its format doesn't
+// depend on this.
+#pragma pack(push, 1)
+
+struct ICMPPingRecord
+{
+    /*
+    The result of one ping, as kept by ICMPPingLog: 10 bytes, rather than
+    the whole ICMPEchoReply.
+    @param target: Whatever the caller uses to tell hosts apart, e.g. the
+    index or tag passed to an ICMPMultiPing or ICMPPingScheduler callback.
+    @param seq: The sequence number of the request.
+    @param rtt: The round trip time, in the units of ICMPEchoReply::rtt.
+    @param status: The Status of the ping.
+    @param ttl: The TTL of the reply.
+    */
+    uint16_t target;
+    uint16_t seq;
+    uint32_t rtt;
+    uint8_t status;
+    uint8_t ttl;
+};
+
+#pragma pack(pop)
+
+
+class ICMPPingLog
+{
+    /*
+    Keeps the results of the last however many pings in a ring buffer of
+    ICMPPingRecords, and writes them out in bulk in a compact binary format,
+    for a program on a PC to pick up. Much cheaper in RAM and serial
+    bandwidth than keeping ICMPEchoReplys or printing a line per ping. When
+    the buffer is full, the oldest record makes way for the newest.
+
+    exportTo() writes a 16 byte header, all in big endian:
+
+       bytes 0-2   "IPL"
+       byte 3      ICMPPING_LOG_VERSION
+       byte 4      flags: bit 0 is set if RTTs are in us rather than ms
+       byte 5      the size of each record (10)
+       bytes 6-7   the number of records that follow
+       bytes 8-11  the number of records added before the first of them,
+                   since the log was made, so that the reader can tell if
+                   any were overwritten before they could be exported
+       bytes 12-15 millis() at the time of the export
+
+    followed by the records, oldest first, each of them the fields of
+    ICMPPingRecord in order: target (2 bytes), seq (2), rtt (4), status (1),
+    ttl (1).
+    */
+
+public:
+    /*
+    @param records: An array of capacity records to keep the log in.
+    @param capacity: The number of records it can hold.
+    */
+    ICMPPingLog(ICMPPingRecord * records, uint16_t capacity);
+
+    /*
+    Add the result of a ping.
+    @param target: See ICMPPingRecord.
+    */
+    template <uint16_t PayloadSize>
+    void add(uint16_t target, const ICMPEchoReplyT<PayloadSize>& result)
+    {
+        add(target, result.data.seq, result.status, result.rtt, result.ttl);
+    }
+
+    void add(uint16_t target, uint16_t seq, Status status, icmp_time_t rtt, uint8_t ttl);
+
+    /*
+    Forget everything in the log.
+    */
+    void clear();
+
+    uint16_t size() const { return _size; }
+    uint16_t capacity() const { return _capacity; }
+
+    /*
+    @return: The ith record in the log, counting from the oldest.
+    */
+    const ICMPPingRecord& operator[](uint16_t i) const;
+
+    /*
+    @return: The number of records added since the log was made.
+    */
+    uint32_t total() const { return _total; }
+
+    /*
+    Write the log to stream in the format described above.
+    @param stream: Where to write it: Serial, an EthernetClient, a File,
+    etc.
+    @param clear: Whether to empty the log afterwards, so that the next
+    export picks up where this one left off.
+    @return: The number of records written.
+    */
+    uint16_t exportTo(Print& stream, bool clear = true);
+
+private:
+
+    ICMPPingRecord * _records;
+    uint16_t _capacity;
+    // index of the oldest record, and the number of records.
+    uint16_t _first;
+    uint16_t _size;
+    uint32_t _total;
+};
+
+#endif
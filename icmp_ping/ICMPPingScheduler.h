@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2010 by Blake Foster <blfoster@vassar.edu>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef ICMPPINGSCHEDULER_H
+#define ICMPPINGSCHEDULER_H
+
+#include "ICMPPing.h"
+#include "ICMPPacer.h"
+
+// ICMPPING_MAX_PENDING -- the number of echo requests an ICMPPingScheduler
+// (and so an ICMPMultiPing) keeps in flight at once. Each slot costs about 20
+// bytes of RAM. Replies wait in the W5100's RX buffer until we get around to
+// reading them, so there's not much point in making this bigger than the
+// buffer can hold (2K, at about 82 bytes per reply with the default payload).
+// On Linux (see ICMPPING_LINUX) it can go up to 65535, since replies wait
+// in the kernel, which holds up to net.core.rmem_max bytes of them per socket.
+#ifndef ICMPPING_MAX_PENDING
+#define ICMPPING_MAX_PENDING 16
+#endif
+#if ICMPPING_MAX_PENDING < 1 || ICMPPING_MAX_PENDING > 65535
+#error "ICMPPING_MAX_PENDING must be from 1 to 65535."
+#endif
+
+// ICMPPING_POLL_BUDGET -- the most replies that one call to
+// ICMPPingScheduler::poll() reads out of the W5100, so that a burst of them
+// can't hold up the rest of loop() for long.
+#ifndef ICMPPING_POLL_BUDGET
+#define ICMPPING_POLL_BUDGET 4
+#endif
+
+
+template <uint16_t PayloadSize>
+class ICMPPingSchedulerT : public ICMPPingT<PayloadSize>
+{
+    /*
+    Pings any number of hosts in the background of a cooperative main loop.
+
+    Queue a request with add(), and call poll() every time around loop().
+    Each call does a bounded amount of work: it sends whatever is queued,
+    reads what has come back, and retries or gives up on whatever has timed
+    out, and runs the callback for each request that's finished. Up to
+    ICMPPING_MAX_PENDING requests can be in flight at once. The socket is
+    opened when the first request is added and closed once they're all
+    finished, unless begin() was called.
+
+       void printResult(uint16_t tag, const ICMPEchoReply& result, void * context)
+       {
+           ...
+       }
+
+       ICMPPingScheduler pinger(0, (uint16_t)random(0, 255));
+
+       void setup()
+       {
+           ...
+           pinger.setCallback(printResult);
+       }
+
+       void loop()
+       {
+           if (it's time)
+               pinger.add(someAddr, 0, 3);
+           pinger.poll();
+           doSomeStuff();
+       }
+    */
+
+public:
+    /*
+    Called once for each request added with add(), when it's finished.
+    @param tag: Whatever was passed to add() along with the request.
+    @param result: The result of the request. Only valid for the duration of
+    the call.
+    @param context: Whatever was passed to setCallback().
+    */
+    typedef void (*Callback)(uint16_t tag, const ICMPEchoReplyT<PayloadSize>& result, void * context);
+
+    /*
+    Construct a scheduler.
+    @param socket: The socket number in the W5100.
+    @param id: The id to put in the ping packets. Can be pretty much any
+    arbitrary number.
+    */
+    ICMPPingSchedulerT(SOCKET s, uint16_t id);
+
+    // blocking pings are still available, when nothing is pending.
+    using ICMPPingT<PayloadSize>::operator();
+
+    /*
+    Set the function to call as each request finishes.
+    */
+    void setCallback(Callback callback, void * context = NULL);
+
+    /*
+    Queue an echo request. Doesn't send anything until the next poll().
+    @param addr: IP address to ping.
+    @param tag: Passed to the callback, to tell the requests apart.
+    @param nRetries: Number of times to try before giving up.
+    @param timeout: Optional timeout estimator for addr; see
+    ICMPTimeoutEstimator. If NULL, ICMPPing::timeout() is used.
+    @return: false if there are already ICMPPING_MAX_PENDING requests in
+    flight.
+    */
+    bool add(const IPAddress& addr, uint16_t tag, int nRetries, ICMPTimeoutEstimator * timeout = NULL);
+
+    /*
+    Move the requests along. Call this as often as possible.
+    @return: The number of requests still in flight.
+    */
+    uint16_t poll();
+
+    /*
+    @return: The number of requests in flight.
+    */
+    uint16_t pending() const { return _numPending; }
+
+protected:
+
+    /*
+    Opens the sockets that the requests go out on, filling in _sockets and
+    _numSockets, and closeSockets() closes them again.
+    */
+    virtual void openSockets();
+    void closeSockets();
+
+    SOCKET _sockets[MAX_SOCK_NUM];
+    uint8_t _numSockets;
+
+private:
+
+    enum PendingState
+    {
+        PENDING_FREE = 0,
+        PENDING_QUEUED, // waiting for a socket to send on
+        PENDING_SENDING, // handed to the W5100, waiting for SEND_OK
+        PENDING_WAITING // sent, waiting for the reply
+    };
+
+    struct Pending
+    {
+        /*
+        A slot in the table of echo requests that we're working on.
+        */
+        uint8_t addr[4];
+        uint16_t tag;
+        uint16_t seq;
+        icmp_time_t sent; // ICMPPING_RTT_CLOCK() time sending started, then at SEND_OK
+        ICMPTimeoutEstimator * timeout;
+        uint8_t attempt;
+        uint8_t retries;
+        uint8_t state;
+        uint8_t socket; // index into _sockets while state is PENDING_SENDING
+    };
+
+    // moves a request along once the W5100 is done sending it.
+    void sendDone(Pending& pending, Status status, ICMPEchoReplyT<PayloadSize>& reply);
+    void finish(Pending& pending, Status status, ICMPEchoReplyT<PayloadSize>& reply);
+    void complete(Pending& pending, ICMPEchoReplyT<PayloadSize>& reply);
+
+    Pending _pending[ICMPPING_MAX_PENDING];
+    uint16_t _numPending;
+    // whether each of _sockets is busy sending.
+    bool _sending[MAX_SOCK_NUM];
+    // the one to try sending on first.
+    uint8_t _nextSocket;
+    // whether poll() ran out of budget before it ran out of replies.
+    bool _backlog;
+
+    Callback _callback;
+    void * _context;
+};
+
+typedef ICMPPingSchedulerT<REQ_DATASIZE> ICMPPingScheduler;
+
+#include "ICMPPingSchedulerImpl.h"
+
+#endif
@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2010 by Blake Foster <blfoster@vassar.edu>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Implementation of the templates declared in ICMPPingScheduler.h.
+ */
+
+#ifndef ICMPPINGSCHEDULERIMPL_H
+#define ICMPPINGSCHEDULERIMPL_H
+
+
+template <uint16_t PayloadSize>
+ICMPPingSchedulerT<PayloadSize>::ICMPPingSchedulerT(SOCKET socket, uint16_t id) :
+  ICMPPingT<PayloadSize>(socket, id), _numSockets(0), _numPending(0), _nextSocket(0), _backlog(false),
+  _callback(NULL), _context(NULL)
+{
+    memset(_pending, 0, sizeof(_pending));
+    memset(_sending, 0, sizeof(_sending));
+}
+
+template <uint16_t PayloadSize>
+void ICMPPingSchedulerT<PayloadSize>::setCallback(Callback callback, void * context)
+{
+    _callback = callback;
+    _context = context;
+}
+
+template <uint16_t PayloadSize>
+void ICMPPingSchedulerT<PayloadSize>::openSockets()
+{
+    _sockets[0] = this->_socket;
+    _numSockets = 1;
+    this->prepareSocket();
+}
+
+template <uint16_t PayloadSize>
+void ICMPPingSchedulerT<PayloadSize>::closeSockets()
+{
+    this->releaseSocket();
+    for (uint8_t s = 1; s < _numSockets; ++s)
+    {
+        this->closeSocket(_sockets[s]);
+    }
+    _numSockets = 0;
+    _nextSocket = 0;
+    memset(_sending, 0, sizeof(_sending));
+}
+
+template <uint16_t PayloadSize>
+bool ICMPPingSchedulerT<PayloadSize>::add(const IPAddress& addr, uint16_t tag, int nRetries,
+                                          ICMPTimeoutEstimator * timeout)
+{
+    for (uint16_t i = 0; i < ICMPPING_MAX_PENDING; ++i)
+    {
+        Pending& pending = _pending[i];
+        if (pending.state != PENDING_FREE)
+            continue;
+
+        if (_numSockets == 0)
+            openSockets();
+
+        for (uint8_t j = 0; j < 4; ++j)
+            pending.addr[j] = addr[j];
+        pending.tag = tag;
+        pending.seq = this->_nextSeq++;
+        pending.timeout = timeout;
+        pending.attempt = 0;
+        pending.retries = nRetries < 1 ? 1 : (nRetries > 255 ? 255 : nRetries);
+        pending.state = PENDING_QUEUED;
+        ++_numPending;
+        return true;
+    }
+    return false;
+}
+
+template <uint16_t PayloadSize>
+void ICMPPingSchedulerT<PayloadSize>::finish(Pending& pending, Status status, ICMPEchoReplyT<PayloadSize>& reply)
+{
+    // report a request that failed, and free up its slot. Replies that we
+    // actually received are reported straight from poll().
+    reply.data = ICMPEchoT<PayloadSize>();
+    reply.data.seq = pending.seq;
+    reply.addr = IPAddress(pending.addr);
+    reply.ttl = 0;
+    reply.rtt = 0;
+    reply.status = status;
+    if (this->_dispatcher)
+        this->_dispatcher->finished(this->_id, pending.seq, reply.addr, status);
+    pending.state = PENDING_FREE;
+    --_numPending;
+    if (_callback)
+        _callback(pending.tag, reply, _context);
+}
+
+template <uint16_t PayloadSize>
+void ICMPPingSchedulerT<PayloadSize>::sendDone(Pending& pending, Status status, ICMPEchoReplyT<PayloadSize>& reply)
+{
+    _sending[pending.socket] = false;
+    if (status == SUCCESS)
+    {
+        pending.sent = ICMPPING_RTT_CLOCK();
+        pending.state = PENDING_WAITING;
+        if (this->_dispatcher)
+            this->_dispatcher->sent(this->_id, pending.seq, IPAddress(pending.addr), pending.sent);
+    }
+    else if (pending.attempt < pending.retries)
+    {
+        pending.state = PENDING_QUEUED;
+    }
+    else
+    {
+        // never made it out of the W5100 (usually ARP failing), so
+        // there's nothing to wait for.
+        finish(pending, status, reply);
+    }
+}
+
+template <uint16_t PayloadSize>
+void ICMPPingSchedulerT<PayloadSize>::complete(Pending& pending, ICMPEchoReplyT<PayloadSize>& reply)
+{
+    // report a reply that we received, and free up its slot.
+    if (reply.status == SUCCESS && reply.data.icmpHeader.type != ICMP_ECHOREP)
+        reply.status = BAD_RESPONSE;
+    reply.rtt = _elapsed(pending.sent, reply.rtt);
+    this->updateTimeout(pending.timeout, reply.status, reply.rtt, pending.attempt);
+    if (this->_dispatcher)
+        this->_dispatcher->finished(this->_id, pending.seq, IPAddress(pending.addr), reply.status);
+    pending.state = PENDING_FREE;
+    --_numPending;
+    if (_callback)
+        _callback(pending.tag, reply, _context);
+}
+
+template <uint16_t PayloadSize>
+uint16_t ICMPPingSchedulerT<PayloadSize>::poll()
+{
+    if (_numSockets == 0)
+        return _numPending;
+
+    ICMPEchoReplyT<PayloadSize> reply;
+
+    // only bother the W5100 if it might have something for us, or if we
+    // left some replies unread last time. Those won't raise INT again.
+    bool events = this->checkInterrupt(_sockets, _numSockets) || _backlog;
+    _backlog = false;
+
+    for (uint16_t i = 0; i < ICMPPING_MAX_PENDING; ++i)
+    {
+        Pending& pending = _pending[i];
+
+        // send anything that's queued on the next socket that's free, if
+        // the pacer lets it go. The sockets take turns, so that the replies
+        // are spread over all of their RX buffers, rather than piling up in
+        // the first one's wherever sending is quick.
+        if (pending.state == PENDING_QUEUED)
+        {
+            for (uint8_t n = 0; n < _numSockets; ++n)
+            {
+                uint8_t s = (_nextSocket + n) % _numSockets;
+                if (_sending[s])
+                    continue;
+                if (this->_pacer && !this->_pacer->take(IPAddress(pending.addr)))
+                    break;
+                ++pending.attempt;
+                this->startEchoRequest(_sockets[s], IPAddress(pending.addr), this->_id, pending.seq,
+                                       this->_payload, PayloadSize, this->_payloadSum);
+                _sending[s] = true;
+                _nextSocket = (s + 1) % _numSockets;
+                pending.socket = s;
+                pending.sent = ICMPPING_RTT_CLOCK();
+                pending.state = PENDING_SENDING;
+                break;
+            }
+        }
+
+        if (pending.state == PENDING_SENDING && events)
+        {
+            Status status = this->pollEchoRequest(_sockets[pending.socket]);
+            if (status != ASYNC_SENT)
+                sendDone(pending, status, reply);
+        }
+    }
+
+    // pick up anything that another object sharing the socket read for us.
+    for (uint16_t i = 0; i < ICMPPING_MAX_PENDING && this->_dispatcher; ++i)
+    {
+        Pending& pending = _pending[i];
+        if (pending.state == PENDING_WAITING
+                && this->_dispatcher->collect(this->_id, pending.seq, IPAddress(pending.addr), reply))
+        {
+            this->noteReply(this->_id, pending.seq, reply.data.icmpHeader.type, reply.status);
+            complete(pending, reply);
+        }
+    }
+
+    // match whatever has come in against the requests we're waiting on.
+    // The W5100 may hand a reply to any of our sockets, not necessarily the
+    // one that sent the request, so check all of them.
+    uint8_t budget = ICMPPING_POLL_BUDGET;
+    for (uint8_t s = 0; s < _numSockets && events; ++s)
+    {
+        uint16_t seq;
+        IPAddress requestAddr;
+        while (_numPending > 0)
+        {
+            if (budget == 0)
+            {
+                _backlog = true;
+                break;
+            }
+            if (!this->readEchoReply(_sockets[s], this->_id, reply, seq, requestAddr, this->_dispatcher))
+                break;
+            --budget;
+            this->noteReply(reply.data.id, seq, reply.data.icmpHeader.type, reply.status);
+            uint16_t i = ICMPPING_MAX_PENDING;
+            if (reply.data.id == this->_id)
+            {
+                for (i = 0; i < ICMPPING_MAX_PENDING; ++i)
+                {
+                    Pending& pending = _pending[i];
+                    if (pending.state == PENDING_WAITING && pending.seq == seq
+                            && requestAddr == pending.addr)
+                    {
+                        complete(pending, reply);
+                        break;
+                    }
+                }
+            }
+            if (i == ICMPPING_MAX_PENDING)
+            {
+                ICMPPING_COUNT(staleReplies, 1);
+                if (this->_dispatcher)
+                    this->_dispatcher->dispatch(reply, seq, requestAddr);
+            }
+        }
+    }
+
+    // retry or give up on anything that has timed out.
+    icmp_time_t now = ICMPPING_RTT_CLOCK();
+    for (uint16_t i = 0; i < ICMPPING_MAX_PENDING; ++i)
+    {
+        Pending& pending = _pending[i];
+        if ((pending.state != PENDING_WAITING && pending.state != PENDING_SENDING)
+                || now - pending.sent < this->replyTimeout(pending.timeout))
+            continue;
+
+        if (pending.state == PENDING_SENDING)
+        {
+            // the W5100 should have finished by now, one way or the other,
+            // unless we missed the interrupt, so look once more. If it's
+            // still going, close and reopen the socket to stop it, so that
+            // the socket can be used again.
+            SOCKET s = _sockets[pending.socket];
+            Status status = this->pollEchoRequest(s);
+            if (status == ASYNC_SENT)
+            {
+                this->openSocket(s);
+                status = SEND_TIMEOUT;
+            }
+            sendDone(pending, status, reply);
+            continue;
+        }
+
+        this->updateTimeout(pending.timeout, NO_RESPONSE, 0, pending.attempt);
+        if (pending.attempt < pending.retries)
+        {
+            pending.state = PENDING_QUEUED;
+            continue;
+        }
+
+        finish(pending, NO_RESPONSE, reply);
+    }
+
+    if (_numPending == 0)
+        closeSockets();
+    return _numPending;
+}
+
+#endif
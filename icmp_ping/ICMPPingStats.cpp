@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2010 by Blake Foster <blfoster@vassar.edu>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+#include <math.h>
+#include "ICMPPingStats.h"
+
+ICMPPingStats::ICMPPingStats()
+{
+    reset();
+}
+
+void ICMPPingStats::reset()
+{
+    _sent = 0;
+    _received = 0;
+    _late = 0;
+    _min = 0;
+    _max = 0;
+    _lastRtt = 0;
+    _mean = 0;
+    _m2 = 0;
+    _jitter = 0;
+    for (uint8_t i = 0; i < ICMPPING_STATS_BUCKETS; ++i)
+    {
+        _histogram[i] = 0;
+    }
+}
+
+void ICMPPingStats::addReply(uint32_t rtt)
+{
+    ++_sent;
+    ++_received;
+
+    if (_received == 1 || rtt < _min)
+        _min = rtt;
+    if (rtt > _max)
+        _max = rtt;
+
+    // Welford's method, which doesn't lose everything to rounding when the
+    // variance is small next to the mean, like summing squares does.
+    float delta = rtt - _mean;
+    _mean += delta / _received;
+    _m2 += delta * (rtt - _mean);
+
+    // RFC 3550 section 6.4.1: J += (|D| - J) / 16, where D is the change in
+    // transit time between two packets. For us that's the change in RTT
+    // since the last reply.
+    if (_received > 1)
+    {
+        uint32_t d = rtt > _lastRtt ? rtt - _lastRtt : _lastRtt - rtt;
+        _jitter += d - ((_jitter + 8) >> 4);
+    }
+    _lastRtt = rtt;
+
+    uint8_t i = bucketFor(rtt);
+    if (_histogram[i] == 0xFFFF)
+    {
+        for (uint8_t j = 0; j < ICMPPING_STATS_BUCKETS; ++j)
+        {
+            _histogram[j] >>= 1;
+        }
+    }
+    ++_histogram[i];
+}
+
+void ICMPPingStats::addLoss()
+{
+    ++_sent;
+}
+
+void ICMPPingStats::addLate(uint32_t rtt)
+{
+    if (lost() == 0)
+        return;
+    // addReply() counts it as sent again.
+    --_sent;
+    ++_late;
+    addReply(rtt);
+}
+
+uint8_t ICMPPingStats::lossPercent() const
+{
+    if (_sent == 0)
+        return 0;
+    return (uint8_t)((float)lost() * 100 / _sent + 0.5);
+}
+
+float ICMPPingStats::varianceRtt() const
+{
+    return _received > 1 ? _m2 / (_received - 1) : 0;
+}
+
+float ICMPPingStats::stddevRtt() const
+{
+    return sqrt(varianceRtt());
+}
+
+uint32_t ICMPPingStats::percentile(uint8_t percent) const
+{
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < ICMPPING_STATS_BUCKETS; ++i)
+    {
+        total += _histogram[i];
+    }
+    if (total == 0)
+        return 0;
+
+    // the rank of the sample we want, counting from 1.
+    uint32_t rank = (total * percent + 99) / 100;
+    if (rank == 0)
+        rank = 1;
+
+    for (uint8_t i = 0; i < ICMPPING_STATS_BUCKETS; ++i)
+    {
+        if (rank > _histogram[i])
+        {
+            rank -= _histogram[i];
+            continue;
+        }
+
+        // assume the samples are spread evenly across the bucket, and take
+        // the middle of the rank'th one's share of it. Nothing can be outside
+        // what we've actually seen, which also gives the last bucket an
+        // upper end.
+        uint32_t start = bucketStart(i);
+        uint32_t end = i + 1 < ICMPPING_STATS_BUCKETS ? bucketStart(i + 1) : _max + 1;
+        if (start < _min)
+            start = _min;
+        if (end > _max + 1)
+            end = _max + 1;
+        if (end <= start)
+            return start;
+        return start + (uint32_t)((float)(end - start) * (2 * rank - 1) / (2 * _histogram[i]));
+    }
+    return _max;
+}
+
+uint8_t ICMPPingStats::bucketFor(uint32_t rtt)
+{
+    // one more than the position of the highest bit that's set.
+    uint8_t i = 0;
+    while (rtt && i < ICMPPING_STATS_BUCKETS - 1)
+    {
+        rtt >>= 1;
+        ++i;
+    }
+    return i;
+}
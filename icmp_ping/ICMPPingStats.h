@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2010 by Blake Foster <blfoster@vassar.edu>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef ICMPPINGSTATS_H
+#define ICMPPINGSTATS_H
+
+#include "ICMPPing.h"
+
+// ICMPPING_STATS_BUCKETS -- the number of buckets in the RTT histogram. Bucket
+// 0 counts RTTs under 1ms (1us if ICMPPING_MICROS_ENABLE is defined), and
+// bucket i counts RTTs from 2^(i-1) up to 2^i of those, except for the last
+// one, which counts everything from there up. Each bucket costs 2 bytes of
+// RAM; with the default the last one starts at about 16 seconds.
+#ifndef ICMPPING_STATS_BUCKETS
+#ifdef ICMPPING_MICROS_ENABLE
+#define ICMPPING_STATS_BUCKETS 26
+#else
+#define ICMPPING_STATS_BUCKETS 16
+#endif
+#endif
+
+
+class ICMPPingStats
+{
+    /*
+    Running statistics on the results of pinging one host, kept in a fixed
+    amount of memory no matter how many results go in: counts of requests
+    and replies, min/max/mean/standard deviation of the RTT, the RFC 3550
+    interarrival jitter, and a log-scaled histogram of RTTs from which
+    percentiles can be estimated. Keep one per host. All times are in the
+    same units as ICMPEchoReply::rtt: ms, or us if ICMPPING_MICROS_ENABLE is
+    defined.
+    */
+
+public:
+    ICMPPingStats();
+
+    /*
+    Forget everything that has been added so far.
+    */
+    void reset();
+
+    /*
+    Add the result of a ping.
+    */
+    template <uint16_t PayloadSize>
+    void add(const ICMPEchoReplyT<PayloadSize>& result)
+    {
+        if (result.status == SUCCESS)
+            addReply(result.rtt);
+        else
+            addLoss();
+    }
+
+    /*
+    Add a request that was answered after rtt.
+    */
+    void addReply(uint32_t rtt);
+
+    /*
+    Add a request that never got an answer.
+    */
+    void addLoss();
+
+    /*
+    Turn one of the losses added so far into a reply that took rtt, because
+    the answer turned up after all, too late for the ping to see it. See
+    ICMPReplyDispatcher::setLateCallback().
+    */
+    void addLate(uint32_t rtt);
+
+    uint32_t sent() const { return _sent; }
+    uint32_t received() const { return _received; }
+    uint32_t lost() const { return _sent - _received; }
+    // the replies, out of received(), that came in too late for the ping.
+    uint32_t late() const { return _late; }
+
+    /*
+    @return: The percentage of requests that went unanswered, rounded to the
+    nearest whole percent.
+    */
+    uint8_t lossPercent() const;
+
+    /*
+    RTT statistics over all the replies. All zero if there haven't been
+    any.
+    */
+    uint32_t minRtt() const { return _received ? _min : 0; }
+    uint32_t maxRtt() const { return _max; }
+    float meanRtt() const { return _mean; }
+    float varianceRtt() const;
+    float stddevRtt() const;
+
+    /*
+    @return: The interarrival jitter of RFC 3550, i.e. a running average of
+    the difference in RTT between successive replies.
+    */
+    float jitter() const { return _jitter / 16.0; }
+
+    /*
+    Estimate an RTT percentile from the histogram, by interpolating within
+    the bucket that it falls in.
+    @param percent: The percentile, e.g. 50 for the median, 99 for p99.
+    @return: The estimated RTT, or 0 if there haven't been any
+    replies.
+    */
+    uint32_t percentile(uint8_t percent) const;
+
+    /*
+    @return: The number of replies counted in bucket i of the histogram.
+    These get halved all at once whenever one of them is about to overflow,
+    so they stay in proportion to each other, but don't add up to
+    received().
+    */
+    uint16_t bucket(uint8_t i) const { return _histogram[i]; }
+
+    /*
+    @return: The lowest RTT that's counted in bucket i.
+    */
+    static uint32_t bucketStart(uint8_t i) { return i ? (uint32_t)1 << (i - 1) : 0; }
+
+private:
+
+    static uint8_t bucketFor(uint32_t rtt);
+
+    uint32_t _sent;
+    uint32_t _received;
+    uint32_t _late;
+    uint32_t _min;
+    uint32_t _max;
+    uint32_t _lastRtt;
+
+    // Welford's running mean, and sum of squared differences from it.
+    float _mean;
+    float _m2;
+
+    // jitter in 16ths, as in the sample code in RFC 3550, so that it can be
+    // kept up to date without division.
+    uint32_t _jitter;
+
+    uint16_t _histogram[ICMPPING_STATS_BUCKETS];
+};
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2010 by Blake Foster <blfoster@vassar.edu>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef ICMPTRACEROUTE_H
+#define ICMPTRACEROUTE_H
+
+#include "ICMPPing.h"
+
+
+struct ICMPTracerouteHop
+{
+    /*
+    One hop of the path found by ICMPTraceroute.
+    @param addr: The address of whoever answered the request sent with this
+    hop's TTL.
+    @param rtt: The round trip time to that address, in ms (us if
+    ICMPPING_MICROS_ENABLE is defined).
+    @param status: SUCCESS if anyone answered, NO_RESPONSE if nobody did
+    before the timeout, SEND_TIMEOUT if the request couldn't be sent, or
+    BAD_CHECKSUM if the answer was damaged on the way.
+    @param type: TIME_EXCEEDED if the answer came from a router along the
+    way, ICMP_ECHOREP if it came from the destination. Only meaningful if
+    status is SUCCESS.
+    */
+    IPAddress addr;
+    icmp_time_t rtt;
+    Status status;
+    uint8_t type;
+};
+
+
+template <uint16_t PayloadSize>
+class ICMPTracerouteT : public ICMPPingT<PayloadSize>
+{
+    /*
+    Function-object for finding the path to a host.
+
+    Sends echo requests with TTLs of 1 up to the maximum number of hops all
+    at once, each with its own sequence number, and then collects the
+    TIME_EXCEEDED messages from the routers along the way, and the echo
+    replies from the destination, in a single timeout window. So tracing a
+    path takes about one timeout, however long it is, rather than one per
+    hop. Some routers limit how fast they send TIME_EXCEEDED, which can cost
+    a hop here and there; try again if one is missing.
+    */
+
+public:
+    /*
+    Construct a traceroute object.
+    @param socket: The socket number in the W5100.
+    @param id: The id to put in the ping packets. Can be pretty much any
+    arbitrary number.
+    */
+    ICMPTracerouteT(SOCKET s, uint16_t id);
+
+    // the ping versions are still available.
+    using ICMPPingT<PayloadSize>::operator();
+
+    /*
+    Traces the path to addr, and blocks until every hop has answered, or
+    the destination and all the hops before it have, or the timeout runs
+    out.
+    @param addr: IP address to trace the path to.
+    @param hops: Array of maxHops hops to fill in. hops[i] is for TTL i + 1.
+    The ones past the destination may be left NO_RESPONSE, since we stop
+    waiting for them once we know where it is.
+    @param maxHops: The greatest TTL to try, at most 255.
+    @return: The number of hops to addr, i.e. the smallest TTL that it
+    answered to, or 0 if it didn't answer to any of them.
+    */
+    uint8_t operator()(const IPAddress& addr, ICMPTracerouteHop * hops, uint8_t maxHops);
+};
+
+typedef ICMPTracerouteT<REQ_DATASIZE> ICMPTraceroute;
+
+#include "ICMPTracerouteImpl.h"
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2010 by Blake Foster <blfoster@vassar.edu>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Implementation of the templates declared in ICMPTraceroute.h.
+ */
+
+#ifndef ICMPTRACEROUTEIMPL_H
+#define ICMPTRACEROUTEIMPL_H
+
+
+template <uint16_t PayloadSize>
+ICMPTracerouteT<PayloadSize>::ICMPTracerouteT(SOCKET socket, uint16_t id) :
+  ICMPPingT<PayloadSize>(socket, id)
+{
+}
+
+template <uint16_t PayloadSize>
+uint8_t ICMPTracerouteT<PayloadSize>::operator()(const IPAddress& addr, ICMPTracerouteHop * hops, uint8_t maxHops)
+{
+    this->prepareSocket();
+
+    // hops[i] goes out with TTL i + 1 and sequence number firstSeq + i.
+    uint16_t firstSeq = this->_nextSeq;
+    this->_nextSeq += maxHops;
+
+    uint8_t numWaiting = 0;
+    Status sendStatus = SUCCESS;
+    for (uint8_t i = 0; i < maxHops; ++i)
+    {
+        ICMPTracerouteHop& hop = hops[i];
+        hop.addr = IPAddress();
+        hop.type = 0;
+
+        // if one didn't make it out, nor will the rest, since they're all
+        // going to the same place.
+        if (sendStatus == SUCCESS)
+            sendStatus = this->sendEchoRequest(this->_socket, addr, this->_id, firstSeq + i,
+                                               this->_payload, PayloadSize, this->_payloadSum, i + 1);
+        if (sendStatus != SUCCESS)
+        {
+            hop.rtt = 0;
+            hop.status = sendStatus;
+            continue;
+        }
+
+        // until the answer turns up, rtt holds the time the request went out.
+        hop.rtt = ICMPPING_RTT_CLOCK();
+        hop.status = NO_RESPONSE;
+        ++numWaiting;
+        ICMPPING_DOYIELD();
+    }
+
+    ICMPEchoReplyT<PayloadSize> reply;
+    uint8_t numHops = 0;
+    icmp_time_t start = millis();
+    bool poll = true;
+    while (numWaiting > 0 && millis() - start < this->ping_timeout)
+    {
+        uint16_t seq;
+        IPAddress requestAddr;
+        if (this->checkInterrupt(this->_socket))
+            poll = true;
+        if (!poll || !this->readEchoReply(this->_socket, this->_id, reply, seq, requestAddr))
+        {
+            poll = false;
+            ICMPPING_DOYIELD();
+            continue;
+        }
+
+        uint16_t i = seq - firstSeq;
+        if (i >= maxHops || !(requestAddr == addr) || hops[i].status != NO_RESPONSE)
+        {
+            ICMPPING_COUNT(staleReplies, 1);
+            continue;
+        }
+
+        ICMPTracerouteHop& hop = hops[i];
+        hop.rtt = _elapsed(hop.rtt, reply.rtt);
+        hop.addr = reply.addr;
+        hop.type = reply.data.icmpHeader.type;
+        hop.status = reply.status;
+        --numWaiting;
+
+        if (hop.status == SUCCESS && hop.type == ICMP_ECHOREP && (numHops == 0 || i + 1 < numHops))
+            numHops = i + 1;
+
+        // once we've got the destination and everything before it, the
+        // echo replies to the higher TTLs don't tell us anything new.
+        if (numHops > 0)
+        {
+            uint8_t j = 0;
+            while (j < numHops && hops[j].status != NO_RESPONSE)
+                ++j;
+            if (j == numHops)
+                break;
+        }
+    }
+
+    for (uint8_t i = 0; i < maxHops; ++i)
+    {
+        if (hops[i].status == NO_RESPONSE)
+            hops[i].rtt = 0;
+    }
+
+    this->releaseSocket();
+    return numHops;
+}
+
+#endif
@@ -0,0 +1,59 @@
+/*
+  Flood Example
+ 
+ This example loads the link to a host with echo requests, 8 at a time,
+ the way ping -l 8 does, and every 1000 requests sends what got through
+ over the serial port: replies per second, payload bytes per second, loss,
+ and the RTTs. Use it to qualify a cable or a switch port between the
+ Arduino and a host you're responsible for.
+
+ Circuit:
+ * Ethernet shield attached to pins 10, 11, 12, 13
+ 
+ */
+
+#include <SPI.h>         
+#include <Ethernet.h>
+#include <ICMPFlood.h>
+
+byte mac[] = {0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED}; // max address for ethernet shield
+byte ip[] = {192,168,2,177}; // ip address for ethernet shield
+IPAddress floodAddr(192,168,2,1); // ip address to flood
+
+SOCKET pingSocket = 0;
+
+char buffer [256];
+ICMPFlood flood(pingSocket, (uint16_t)random(0, 255));
+ICMPPingStats stats;
+
+void setup() 
+{
+  // start Ethernet
+  Ethernet.begin(mac, ip);
+  Serial.begin(9600);
+
+  // nobody on a LAN should take more than 100ms to answer.
+  ICMPPing::setTimeout(100);
+}
+
+void loop()
+{
+  ICMPFloodResult result;
+  flood(floodAddr, 1000, 8, result, &stats);
+
+  sprintf(buffer,
+          "%ld sent, %ld received, %d%% loss in %ldms: %ld packets/s, %ld bytes/s, "
+          "min/avg/max %ld/%ld/%ld" ICMPPING_RTT_UNIT,
+          (long)result.sent,
+          (long)result.received,
+          stats.lossPercent(),
+          (long)result.elapsed,
+          (long)result.packetsPerSecond(),
+          (long)result.goodput(),
+          (long)stats.minRtt(),
+          (long)stats.meanRtt(),
+          (long)stats.maxRtt());
+  Serial.println(buffer);
+  stats.reset();
+  delay(5000);
+}
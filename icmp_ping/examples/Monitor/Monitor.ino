@@ -0,0 +1,65 @@
+/*
+  Monitor Example
+ 
+ This example keeps an eye on a handful of hosts, pinging each of them
+ every 5 seconds or so, and sends a line over the serial port whenever one
+ of them goes down or comes back up. A host has to miss 3 of its last 5
+ pings to be counted as down, and answer 3 of its last 5 to come back, so
+ the odd lost ping goes unreported.
+
+ Circuit:
+ * Ethernet shield attached to pins 10, 11, 12, 13
+ 
+ */
+
+#include <SPI.h>         
+#include <Ethernet.h>
+#include <ICMPMonitor.h>
+
+byte mac[] = {0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED}; // max address for ethernet shield
+byte ip[] = {192,168,2,177}; // ip address for ethernet shield
+
+#define NUM_HOSTS 4
+
+// ip addresses to watch
+IPAddress hosts[NUM_HOSTS] = {
+  IPAddress(192,168,2,1),
+  IPAddress(192,168,2,2),
+  IPAddress(192,168,2,3),
+  IPAddress(74,125,26,147)
+};
+
+SOCKET pingSocket = 0;
+
+char buffer [256];
+ICMPMonitorTarget targets[NUM_HOSTS];
+ICMPMonitor monitor(pingSocket, (uint16_t)random(0, 255), targets, NUM_HOSTS);
+
+void printChange(uint16_t index, const ICMPMonitorTarget& target, void * context)
+{
+  sprintf(buffer,
+          "%d.%d.%d.%d is %s",
+          target.addr[0],
+          target.addr[1],
+          target.addr[2],
+          target.addr[3],
+          target.state == HOST_UP ? "up" : "down");
+  Serial.println(buffer);
+}
+
+void setup() 
+{
+  // start Ethernet
+  Ethernet.begin(mac, ip);
+  Serial.begin(9600);
+
+  monitor.setChangeCallback(printChange);
+  for (int i = 0; i < NUM_HOSTS; ++i)
+    monitor.watch(hosts[i], 5000);
+  monitor.begin();
+}
+
+void loop()
+{
+  monitor.poll();
+}
@@ -38,14 +38,14 @@ void loop()
   if (echoReply.status == SUCCESS)
   {
     sprintf(buffer,
-            "Reply[%d] from: %d.%d.%d.%d: bytes=%d time=%ldms TTL=%d",
+            "Reply[%d] from: %d.%d.%d.%d: bytes=%d time=%ld" ICMPPING_RTT_UNIT " TTL=%d",
             echoReply.data.seq,
             echoReply.addr[0],
             echoReply.addr[1],
             echoReply.addr[2],
             echoReply.addr[3],
             REQ_DATASIZE,
-            millis() - echoReply.data.time,
+            (long)echoReply.rtt,
             echoReply.ttl);
   }
   else
@@ -53,6 +53,20 @@ void loop()
     sprintf(buffer, "Echo request failed; %d", echoReply.status);
   }
   Serial.println(buffer);
+#ifdef ICMPPING_PROFILE_ENABLE
+  // where the time went, and how much SPI traffic it took, so far.
+  ICMPPingProfile profile = ICMPPing::profile();
+  sprintf(buffer,
+          "  registers: %ld reads, %ld writes; bytes: %ld in, %ld out; us: send %ld, wait %ld, read %ld",
+          (long)profile.registerReads,
+          (long)profile.registerWrites,
+          (long)profile.bytesRead,
+          (long)profile.bytesWritten,
+          (long)profile.sendTime,
+          (long)profile.waitTime,
+          (long)profile.readTime);
+  Serial.println(buffer);
+#endif
   delay(500);
 }
 
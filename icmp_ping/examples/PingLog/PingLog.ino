@@ -0,0 +1,72 @@
+/*
+  Ping Log Example
+ 
+ This example pings a few hosts every second in the background, and keeps
+ the results in an ICMPPingLog: 10 bytes per ping, 200 pings, in 2K of RAM.
+ Nothing is sent over the serial port until a program on the other end asks
+ for it by sending any byte, and then the whole log goes out at once in
+ binary. See ICMPPingLog.h for the format.
+
+ Circuit:
+ * Ethernet shield attached to pins 10, 11, 12, 13
+ 
+ */
+
+#include <SPI.h>         
+#include <Ethernet.h>
+#include <ICMPPingScheduler.h>
+#include <ICMPPingLog.h>
+
+byte mac[] = {0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED}; // max address for ethernet shield
+byte ip[] = {192,168,2,177}; // ip address for ethernet shield
+
+#define NUM_HOSTS 3
+IPAddress hosts[NUM_HOSTS] = {
+  IPAddress(192,168,2,1),
+  IPAddress(8,8,8,8),
+  IPAddress(74,125,26,147)
+};
+
+SOCKET pingSocket = 0;
+
+ICMPPingScheduler pinger(pingSocket, (uint16_t)random(0, 255));
+unsigned long lastSweep = 0;
+
+#define LOG_SIZE 200
+ICMPPingRecord records[LOG_SIZE];
+ICMPPingLog pingLog(records, LOG_SIZE);
+
+void logResult(uint16_t tag, const ICMPEchoReply& echoReply, void * context)
+{
+  pingLog.add(tag, echoReply);
+}
+
+void setup() 
+{
+  // start Ethernet
+  Ethernet.begin(mac, ip);
+  Serial.begin(115200);
+
+  pinger.setCallback(logResult);
+}
+
+void loop()
+{
+  if (millis() - lastSweep > 1000 && pinger.pending() == 0)
+  {
+    for (uint16_t i = 0; i < NUM_HOSTS; ++i)
+    {
+      pinger.add(hosts[i], i, 1);
+    }
+    lastSweep = millis();
+  }
+
+  pinger.poll();
+
+  if (Serial.available())
+  {
+    while (Serial.available())
+      Serial.read();
+    pingLog.exportTo(Serial);
+  }
+}
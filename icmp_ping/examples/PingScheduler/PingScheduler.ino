@@ -0,0 +1,79 @@
+/*
+  Ping Scheduler Example
+ 
+ This example pings a few hosts every 5 seconds in the background, while
+ loop() carries on blinking an LED, and sends the results over the serial
+ port as they come in. Unlike the PingAsync example, it doesn't need
+ ICMPPING_ASYNCH_ENABLE, and it doesn't have to check on each ping itself.
+
+ Circuit:
+ * Ethernet shield attached to pins 10, 11, 12, 13
+ 
+ */
+
+#include <SPI.h>         
+#include <Ethernet.h>
+#include <ICMPPingScheduler.h>
+
+byte mac[] = {0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED}; // max address for ethernet shield
+byte ip[] = {192,168,2,177}; // ip address for ethernet shield
+
+#define NUM_HOSTS 3
+IPAddress hosts[NUM_HOSTS] = {
+  IPAddress(192,168,2,1),
+  IPAddress(8,8,8,8),
+  IPAddress(74,125,26,147)
+};
+
+SOCKET pingSocket = 0;
+
+char buffer [256];
+ICMPPingScheduler pinger(pingSocket, (uint16_t)random(0, 255));
+unsigned long lastSweep = 0;
+
+void printResult(uint16_t tag, const ICMPEchoReply& echoReply, void * context)
+{
+  if (echoReply.status == SUCCESS)
+  {
+    sprintf(buffer,
+            "Reply from: %d.%d.%d.%d: time=%ld" ICMPPING_RTT_UNIT " TTL=%d",
+            echoReply.addr[0],
+            echoReply.addr[1],
+            echoReply.addr[2],
+            echoReply.addr[3],
+            (long)echoReply.rtt,
+            echoReply.ttl);
+  }
+  else
+  {
+    sprintf(buffer, "Host %d: echo request failed; %d", tag, echoReply.status);
+  }
+  Serial.println(buffer);
+}
+
+void setup() 
+{
+  // start Ethernet
+  Ethernet.begin(mac, ip);
+  Serial.begin(9600);
+  pinMode(LED_BUILTIN, OUTPUT);
+
+  pinger.setCallback(printResult);
+}
+
+void loop()
+{
+  if (millis() - lastSweep > 5000 && pinger.pending() == 0)
+  {
+    for (uint16_t i = 0; i < NUM_HOSTS; ++i)
+    {
+      pinger.add(hosts[i], i, 3);
+    }
+    lastSweep = millis();
+  }
+
+  pinger.poll();
+
+  // other stuff carries on in the meantime.
+  digitalWrite(LED_BUILTIN, (millis() / 500) % 2);
+}
@@ -0,0 +1,77 @@
+/*
+  Ping Statistics Example
+ 
+ This example pings a host every 500 milliseconds, and every 100 pings
+ sends a summary of the results over the serial port: loss, min/avg/max
+ RTT, jitter, and the median and 99th percentile RTT. Replies that turn up
+ after the ping has timed out are caught by an ICMPReplyDispatcher, and
+ counted as late rather than lost. The number of replies that arrived out
+ of order or more than once since the start is printed too.
+
+ Circuit:
+ * Ethernet shield attached to pins 10, 11, 12, 13
+ 
+ */
+
+#include <SPI.h>         
+#include <Ethernet.h>
+#include <ICMPPing.h>
+#include <ICMPPingStats.h>
+
+byte mac[] = {0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED}; // max address for ethernet shield
+byte ip[] = {192,168,2,177}; // ip address for ethernet shield
+IPAddress pingAddr(74,125,26,147); // ip address to ping
+
+SOCKET pingSocket = 0;
+
+char buffer [256];
+ICMPPing ping(pingSocket, (uint16_t)random(0, 255));
+ICMPPingStats stats;
+ICMPReplyDispatcher dispatcher;
+
+void countLate(const IPAddress& addr, uint16_t seq, icmp_time_t rtt, void * context)
+{
+  ((ICMPPingStats *)context)->addLate(rtt);
+}
+
+void setup() 
+{
+  // start Ethernet
+  Ethernet.begin(mac, ip);
+  Serial.begin(9600);
+
+  // keep the socket open, so that late replies wait in it for the next ping.
+  dispatcher.setLateCallback(countLate, &stats);
+  ping.setDispatcher(&dispatcher);
+  ping.begin();
+}
+
+void loop()
+{
+  ICMPEchoReply echoReply = ping(pingAddr, 1);
+  stats.add(echoReply);
+
+  if (stats.sent() == 100)
+  {
+    sprintf(buffer,
+            "%ld sent, %ld received (%ld late), %d%% loss, "
+            "min/avg/max %ld/%ld/%ld" ICMPPING_RTT_UNIT ", jitter %ld" ICMPPING_RTT_UNIT ", "
+            "p50 %ld" ICMPPING_RTT_UNIT ", p99 %ld" ICMPPING_RTT_UNIT ", "
+            "%ld reordered and %ld duplicates so far",
+            (long)stats.sent(),
+            (long)stats.received(),
+            (long)stats.late(),
+            stats.lossPercent(),
+            (long)stats.minRtt(),
+            (long)stats.meanRtt(),
+            (long)stats.maxRtt(),
+            (long)stats.jitter(),
+            (long)stats.percentile(50),
+            (long)stats.percentile(99),
+            (long)ping.sequence().reordered(),
+            (long)ping.sequence().duplicates());
+    Serial.println(buffer);
+    stats.reset();
+  }
+  delay(500);
+}
@@ -0,0 +1,68 @@
+/*
+  Ping Sweep Example
+ 
+ This example pings the first NUM_HOSTS hosts on a /24 subnet at once,
+ using a single socket, and sends the addresses of the hosts that answered
+ over the serial port.
+
+ Circuit:
+ * Ethernet shield attached to pins 10, 11, 12, 13
+ 
+ */
+
+#include <SPI.h>         
+#include <Ethernet.h>
+#include <ICMPMultiPing.h>
+#include <ICMPPacer.h>
+
+byte mac[] = {0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED}; // max address for ethernet shield
+byte ip[] = {192,168,2,177}; // ip address for ethernet shield
+
+// each address costs a few bytes of RAM, so an Uno can't hold a whole /24.
+#define NUM_HOSTS 64
+
+SOCKET pingSocket = 0;
+
+IPAddress hosts [NUM_HOSTS];
+char buffer [256];
+ICMPMultiPing ping(pingSocket, (uint16_t)random(0, 255));
+// at most 50 requests a second, in bursts of up to 8, so that we don't
+// trip any firewall's ICMP rate limit and mistake that for hosts being down.
+ICMPPacer pacer(50, 8);
+
+void printResult(uint16_t index, const ICMPEchoReply& echoReply, void * context)
+{
+  if (echoReply.status == SUCCESS)
+  {
+    sprintf(buffer,
+            "Reply from: %d.%d.%d.%d: time=%ld" ICMPPING_RTT_UNIT " TTL=%d",
+            echoReply.addr[0],
+            echoReply.addr[1],
+            echoReply.addr[2],
+            echoReply.addr[3],
+            (long)echoReply.rtt,
+            echoReply.ttl);
+    Serial.println(buffer);
+  }
+}
+
+void setup() 
+{
+  // start Ethernet
+  Ethernet.begin(mac, ip);
+  Serial.begin(9600);
+  ping.setPacer(&pacer);
+
+  for (int i = 0; i < NUM_HOSTS; ++i)
+  {
+    hosts[i] = IPAddress(ip[0], ip[1], ip[2], i + 1);
+  }
+}
+
+void loop()
+{
+  uint16_t numUp = ping(hosts, NUM_HOSTS, 2, printResult);
+  sprintf(buffer, "%d hosts up", numUp);
+  Serial.println(buffer);
+  delay(10000);
+}
@@ -0,0 +1,64 @@
+/*
+  Traceroute Example
+ 
+ This example traces the path to a host every 10 seconds, and sends the
+ address and round trip time of each hop over the serial port.
+
+ Circuit:
+ * Ethernet shield attached to pins 10, 11, 12, 13
+ 
+ */
+
+#include <SPI.h>         
+#include <Ethernet.h>
+#include <ICMPTraceroute.h>
+
+byte mac[] = {0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED}; // max address for ethernet shield
+byte ip[] = {192,168,2,177}; // ip address for ethernet shield
+IPAddress traceAddr(74,125,26,147); // ip address to trace the path to
+
+#define MAX_HOPS 30
+
+SOCKET pingSocket = 0;
+
+char buffer [256];
+// no need for a payload just to find the path.
+ICMPTracerouteT<0> traceroute(pingSocket, (uint16_t)random(0, 255));
+ICMPTracerouteHop hops [MAX_HOPS];
+
+void setup() 
+{
+  // start Ethernet
+  Ethernet.begin(mac, ip);
+  Serial.begin(9600);
+}
+
+void loop()
+{
+  uint8_t numHops = traceroute(traceAddr, hops, MAX_HOPS);
+  uint8_t last = numHops ? numHops : MAX_HOPS;
+  for (uint8_t i = 0; i < last; ++i)
+  {
+    if (hops[i].status == SUCCESS)
+    {
+      sprintf(buffer,
+              "%2d  %d.%d.%d.%d  %ld" ICMPPING_RTT_UNIT,
+              i + 1,
+              hops[i].addr[0],
+              hops[i].addr[1],
+              hops[i].addr[2],
+              hops[i].addr[3],
+              (long)hops[i].rtt);
+    }
+    else
+    {
+      sprintf(buffer, "%2d  *", i + 1);
+    }
+    Serial.println(buffer);
+  }
+  if (numHops == 0)
+  {
+    Serial.println("Destination not reached");
+  }
+  delay(10000);
+}
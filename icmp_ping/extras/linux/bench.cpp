@@ -0,0 +1,138 @@
+/*
+  Linux Benchmark
+
+ Times the library's packet handling on a Linux box: building, serializing
+ and parsing echo packets, and the checksum, in ns per call, then pings the
+ loopback address to show what each ping costs: the time to send and read
+ it, the chip calls and bytes copied, and how much stack it takes. Then the
+ RAM used by the main classes. Build it along with the library, e.g. from
+ the icmp_ping directory:
+
+    g++ -O2 -DICMPPING_LINUX -DICMPPING_PROFILE_ENABLE -I . *.cpp extras/linux/bench.cpp -o bench
+
+ The loopback part needs ICMPPING_PROFILE_ENABLE, and the same permissions
+ as extras/linux/ping.cpp. On Linux the chip calls are just copies in and
+ out of a buffer; for what they'd cost over SPI, see extras/sim/bench.cpp.
+
+ */
+
+#include <stdio.h>
+#include <ICMPPing.h>
+#include <ICMPPingScheduler.h>
+
+#define ITERATIONS 1000000
+#define PINGS 1000
+#define STACK_PAINT 16384
+
+// stops the compiler from optimizing away the work being timed.
+volatile uint16_t sink;
+
+uint64_t nanos()
+{
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void report(const char * name, uint64_t start)
+{
+  printf("%-12s %6.1f ns\n", name, (double)(nanos() - start) / ITERATIONS);
+}
+
+// fill the stack below the caller with a pattern, and afterwards see how
+// much of it was overwritten. Both have to be called from the same place.
+__attribute__((noinline)) void paintStack()
+{
+  uint8_t stack[STACK_PAINT];
+  volatile uint8_t * paint = stack;
+  for (uint16_t i = 0; i < STACK_PAINT; ++i)
+    paint[i] = 0xA5;
+}
+
+__attribute__((noinline)) uint16_t usedStack()
+{
+  uint8_t stack[STACK_PAINT];
+  volatile uint8_t * paint = stack;
+  uint16_t i = 0;
+  while (i < STACK_PAINT && paint[i] == 0xA5)
+    ++i;
+  return STACK_PAINT - i;
+}
+
+int main()
+{
+  uint8_t payload[REQ_DATASIZE];
+  for (uint16_t i = 0; i < REQ_DATASIZE; ++i)
+    payload[i] = i;
+  uint16_t payloadSum = ICMPEcho::payloadSum(payload);
+  uint8_t wire[ICMPEcho::wireSize];
+
+  uint64_t start = nanos();
+  for (uint32_t i = 0; i < ITERATIONS; ++i)
+  {
+    ICMPEcho echo(ICMP_ECHOREQ, 42, i, payload, payloadSum);
+    echo.serialize(wire);
+    sink += wire[3];
+  }
+  report("serialize", start);
+
+  ICMPEcho echo;
+  start = nanos();
+  for (uint32_t i = 0; i < ITERATIONS; ++i)
+  {
+    wire[7] = i;
+    echo.deserialize(wire);
+    sink += echo.seq;
+  }
+  report("deserialize", start);
+
+  start = nanos();
+  for (uint32_t i = 0; i < ITERATIONS; ++i)
+  {
+    wire[7] = i;
+    sink += _onesSum(wire, sizeof(wire));
+  }
+  report("_onesSum", start);
+
+  start = nanos();
+  for (uint32_t i = 0; i < ITERATIONS; ++i)
+  {
+    sink += _checksum(echo.icmpHeader, 42, i, i, payloadSum);
+  }
+  report("_checksum", start);
+
+#ifdef ICMPPING_PROFILE_ENABLE
+  ICMPPing ping(0, 42);
+  ping.begin();
+  ICMPPing::resetProfile();
+  uint16_t received = 0;
+  paintStack();
+  for (uint16_t i = 0; i < PINGS; ++i)
+  {
+    received += ping(IPAddress(127, 0, 0, 1), 1).status == SUCCESS;
+  }
+  uint16_t stack = usedStack();
+  ping.end();
+
+  ICMPPingProfile profile = ICMPPing::profile();
+  if (received == 0)
+  {
+    printf("no replies from 127.0.0.1\n");
+    return 1;
+  }
+  printf("%d of %d pings answered\n", received, PINGS);
+  printf("send         %6.2f us\n", (double)profile.sendTime / profile.requests);
+  printf("read         %6.2f us\n", (double)profile.readTime / received);
+  printf("bytes out    %6.1f per request\n", (double)profile.bytesWritten / profile.requests);
+  printf("bytes in     %6.1f per reply\n", (double)profile.bytesRead / received);
+  printf("reads        %6.1f per ping\n", (double)profile.registerReads / PINGS);
+  printf("writes       %6.1f per ping\n", (double)profile.registerWrites / PINGS);
+  printf("foreign      %6lu packets\n", (unsigned long)profile.foreignPackets);
+  printf("stale        %6lu replies\n", (unsigned long)profile.staleReplies);
+  printf("stack        %6d bytes\n", stack);
+#endif
+
+  printf("RAM: ICMPPing %d, ICMPEchoReply %d, ICMPPingScheduler %d bytes\n",
+         (int)sizeof(ICMPPing), (int)sizeof(ICMPEchoReply), (int)sizeof(ICMPPingScheduler));
+  return 0;
+}
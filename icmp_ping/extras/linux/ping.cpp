@@ -0,0 +1,139 @@
+/*
+  Linux Example
+
+ Pings a host four times, traces the path to it, or sweeps a range of
+ addresses starting from it, from a Linux box rather than an Arduino. Build
+ it along with the library, e.g. from the icmp_ping directory:
+
+    g++ -O2 -DICMPPING_LINUX -I . *.cpp extras/linux/ping.cpp -o ping
+
+ and try it against the loopback network, which answers on all of
+ 127.0.0.0/8:
+
+    ./ping 127.0.0.1
+    ./ping -t 127.0.0.1
+    ./ping -s 127.0.0.1 1000
+
+ Without root, the system has to allow unprivileged ping sockets for your
+ group (see net.ipv4.ping_group_range); otherwise run it as root, and raw
+ sockets are used instead.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ICMPPing.h>
+#include <ICMPMultiPing.h>
+#include <ICMPPingStats.h>
+#include <ICMPTraceroute.h>
+
+#define MAX_HOPS 30
+
+SOCKET pingSocket = 0;
+uint8_t pingId = 42;
+
+bool parseAddress(const char * text, IPAddress& addr)
+{
+  unsigned a, b, c, d;
+  if (sscanf(text, "%u.%u.%u.%u", &a, &b, &c, &d) != 4 || a > 255 || b > 255 || c > 255 || d > 255)
+    return false;
+  addr = IPAddress(a, b, c, d);
+  return true;
+}
+
+int ping(const IPAddress& addr)
+{
+  ICMPPing ping(pingSocket, pingId);
+  ICMPPingStats stats;
+  for (int i = 0; i < 4; ++i)
+  {
+    ICMPEchoReply echoReply = ping(addr, 1);
+    stats.add(echoReply);
+    if (echoReply.status == SUCCESS)
+    {
+      printf("Reply[%d] from: %d.%d.%d.%d: bytes=%d time=%ld" ICMPPING_RTT_UNIT " TTL=%d\n",
+             echoReply.data.seq,
+             echoReply.addr[0],
+             echoReply.addr[1],
+             echoReply.addr[2],
+             echoReply.addr[3],
+             REQ_DATASIZE,
+             (long)echoReply.rtt,
+             echoReply.ttl);
+    }
+    else
+    {
+      printf("Echo request failed; %d\n", echoReply.status);
+    }
+    delay(500);
+  }
+  printf("%ld sent, %ld received, min/avg/max %ld/%ld/%ld" ICMPPING_RTT_UNIT "\n",
+         (long)stats.sent(),
+         (long)stats.received(),
+         (long)stats.minRtt(),
+         (long)stats.meanRtt(),
+         (long)stats.maxRtt());
+  return stats.received() ? 0 : 1;
+}
+
+int trace(const IPAddress& addr)
+{
+  ICMPTracerouteT<0> traceroute(pingSocket, pingId);
+  ICMPTracerouteHop hops[MAX_HOPS];
+  uint8_t numHops = traceroute(addr, hops, MAX_HOPS);
+  uint8_t last = numHops ? numHops : MAX_HOPS;
+  for (uint8_t i = 0; i < last; ++i)
+  {
+    if (hops[i].status == SUCCESS)
+      printf("%2d  %d.%d.%d.%d  %ld" ICMPPING_RTT_UNIT "\n", i + 1,
+             hops[i].addr[0], hops[i].addr[1], hops[i].addr[2], hops[i].addr[3],
+             (long)hops[i].rtt);
+    else
+      printf("%2d  *\n", i + 1);
+  }
+  if (numHops == 0)
+    printf("Destination not reached\n");
+  return numHops ? 0 : 1;
+}
+
+void printDown(uint16_t index, const ICMPEchoReply& echoReply, void * context)
+{
+  const IPAddress * addrs = (const IPAddress *)context;
+  if (echoReply.status != SUCCESS)
+    printf("%d.%d.%d.%d is down\n", addrs[index][0], addrs[index][1], addrs[index][2], addrs[index][3]);
+}
+
+int sweep(const IPAddress& first, uint16_t count)
+{
+  IPAddress * addrs = new IPAddress[count];
+  uint32_t start = (uint32_t)first[0] << 24 | (uint32_t)first[1] << 16 | (uint32_t)first[2] << 8 | first[3];
+  for (uint16_t i = 0; i < count; ++i)
+  {
+    uint32_t addr = start + i;
+    addrs[i] = IPAddress(addr >> 24, addr >> 16, addr >> 8, addr);
+  }
+
+  // every socket there is, with up to ICMPPING_MAX_PENDING requests in flight
+  // between them.
+  ICMPPingPool pool(pingSocket, pingId);
+  uint32_t started = millis();
+  uint16_t up = pool(addrs, count, 1, printDown, addrs);
+  printf("%d of %d up in %ldms\n", up, count, (long)(millis() - started));
+  delete [] addrs;
+  return up == count ? 0 : 1;
+}
+
+int main(int argc, char ** argv)
+{
+  IPAddress addr;
+  if (argc == 2 && parseAddress(argv[1], addr))
+    return ping(addr);
+  if (argc == 3 && strcmp(argv[1], "-t") == 0 && parseAddress(argv[2], addr))
+    return trace(addr);
+  if (argc == 4 && strcmp(argv[1], "-s") == 0 && parseAddress(argv[2], addr) && atoi(argv[3]) > 0)
+    return sweep(addr, atoi(argv[3]));
+
+  fprintf(stderr, "usage: %s [-t] address\n       %s -s address count\n", argv[0], argv[0]);
+  return 2;
+}
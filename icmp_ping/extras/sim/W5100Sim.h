@@ -0,0 +1,519 @@
+/*
+ * Copyright (c) 2010 by Blake Foster <blfoster@vassar.edu>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * A W5100, and the network beyond it, in software, so that the library can
+ * be run and measured on a PC without flashing anything. Use it as the
+ * platform header, from the icmp_ping directory:
+ *
+ *    g++ -O2 -std=c++17 -DICMPPING_PLATFORM_HEADER='"extras/sim/W5100Sim.h"' \
+ *        -I . *.cpp your_program.cpp
+ *
+ * The W5100 object has the same interface as the Ethernet library's, as far
+ * as the library uses it, plus some knobs for the network: latency, jitter
+ * (enough of it and replies overtake each other), loss, and a number of
+ * routers on the way, which answer requests whose TTL runs out with
+ * TIME_EXCEEDED. It also counts the SPI frames the real chip would have
+ * needed, one for each byte of a register or buffer, and keeps track of
+ * how deep the stack got in calls to it. See extras/sim/bench.cpp.
+ *
+ * With ICMPPING_W5500 defined as well, it's a W5500 instead, reached through
+ * a w5500 object like the Ethernet2 library's and through SPI and
+ * digitalWrite() for the frames the library makes itself. A W5500 frame can
+ * move any number of bytes, so it's counted once per chip select.
+ *
+ * The clock is simulated too, and only moves when the chip is used, by
+ * frameTime for each W5100 frame (or a quarter of it for each byte of a
+ * W5500 one), in delay(), and by a us whenever it's read. So
+ * timings come out roughly as they would on the board, however fast the PC
+ * is, and a 1s timeout doesn't take a second. There's no INT pin, so
+ * ICMPPING_INTERRUPTS_ENABLE isn't supported.
+ */
+
+#ifndef W5100SIM_H
+#define W5100SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <deque>
+#include <vector>
+
+#ifdef ICMPPING_INTERRUPTS_ENABLE
+#error "ICMPPING_INTERRUPTS_ENABLE needs an INT pin, which the simulator doesn't have."
+#endif
+
+typedef uint8_t byte;
+typedef uint8_t SOCKET;
+
+#ifdef ICMPPING_W5500
+#define MAX_SOCK_NUM 8
+#else
+#define MAX_SOCK_NUM 4
+#endif
+
+inline uint32_t micros();
+inline uint32_t millis();
+inline void delay(unsigned long ms);
+
+
+class IPAddress
+{
+public:
+    IPAddress() { memset(_address, 0, sizeof(_address)); }
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+    {
+        _address[0] = a;
+        _address[1] = b;
+        _address[2] = c;
+        _address[3] = d;
+    }
+    IPAddress(const uint8_t * address) { memcpy(_address, address, sizeof(_address)); }
+
+    uint8_t operator[](int i) const { return _address[i]; }
+    uint8_t& operator[](int i) { return _address[i]; }
+
+    bool operator==(const IPAddress& addr) const { return memcmp(_address, addr._address, sizeof(_address)) == 0; }
+    bool operator==(const uint8_t * addr) const { return memcmp(_address, addr, sizeof(_address)) == 0; }
+    bool operator!=(const IPAddress& addr) const { return !(*this == addr); }
+
+private:
+    uint8_t _address[4];
+};
+
+
+class Print
+{
+public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t b) = 0;
+
+    virtual size_t write(const uint8_t * buffer, size_t size)
+    {
+        size_t n = 0;
+        while (n < size && write(buffer[n]))
+            ++n;
+        return n;
+    }
+};
+
+
+class SnIR
+{
+public:
+    static const uint8_t SEND_OK = 0x10;
+    static const uint8_t TIMEOUT = 0x08;
+    static const uint8_t RECV = 0x04;
+};
+
+class SnMR
+{
+public:
+    static const uint8_t CLOSE = 0x00;
+    static const uint8_t IPRAW = 0x03;
+};
+
+class SnSR
+{
+public:
+    static const uint8_t CLOSED = 0x00;
+    static const uint8_t IPRAW = 0x32;
+};
+
+class IPPROTO
+{
+public:
+    static const uint8_t ICMP = 1;
+};
+
+enum SockCMD
+{
+    Sock_OPEN = 0x01,
+    Sock_CLOSE = 0x10,
+    Sock_SEND = 0x20,
+    Sock_RECV = 0x40
+};
+
+
+class W5100Sim
+{
+public:
+    static const uint16_t SSIZE = 2048;
+    static const uint16_t SMASK = SSIZE - 1;
+
+    // the network. Change these whenever you like; they apply to requests
+    // sent from then on.
+    uint16_t latency; // round trip to a host, in ms
+    uint16_t jitter; // up to this many ms more, at random
+    uint8_t loss; // the percentage of requests that go unanswered
+    uint8_t hops; // routers on the way to every host
+    bool (*answers)(const IPAddress& addr); // whether addr is up; everyone if NULL
+    uint16_t frameTime; // how long a 4 byte SPI frame takes, in us
+
+    // SPI frames since the start, or the last reset(): on the real W5100
+    // each one moves a single byte, on the W5500 as many as it likes.
+    uint32_t frames;
+    // the lowest stack address seen in a call to the chip.
+    uintptr_t stackLow;
+
+    W5100Sim() :
+      latency(0), jitter(0), loss(0), hops(0), answers(NULL), frameTime(8),
+      _now(0), _imr(0), _spiCount(0), _spiAddr(0), _spiControl(0), _seed(2463534242UL)
+    {
+        memset(_sockets, 0, sizeof(_sockets));
+        reset();
+    }
+
+    void reset()
+    {
+        frames = 0;
+        stackLow = UINTPTR_MAX;
+    }
+
+    // the address of router hop (from 1), as it appears in TIME_EXCEEDED.
+    static IPAddress router(uint8_t hop) { return IPAddress(10, 0, 0, hop); }
+
+    // put len bytes straight into socket s's RX buffer, whatever they are,
+    // as far as they fit. For fuzzing the library's parser.
+    void receive(SOCKET s, const uint8_t * data, uint16_t len)
+    {
+        Socket& sock = _sockets[s];
+        uint16_t room = SSIZE - (uint16_t)(sock.rxWr - sock.rxRd);
+        if (len > room)
+            len = room;
+        for (uint16_t i = 0; i < len; ++i)
+            sock.rx[(uint16_t)(sock.rxWr + i) & SMASK] = data[i];
+        sock.rxWr += len;
+        sock.ir |= SnIR::RECV;
+    }
+
+    // the simulated time, in us.
+    uint32_t now() { return _now++; }
+    void wait(uint32_t us)
+    {
+        _now += us;
+        deliver();
+    }
+
+    void execCmdSn(SOCKET s, SockCMD cmd)
+    {
+        Socket& sock = enter(s, 2, 2);
+        if (cmd == Sock_OPEN)
+        {
+            sock.sr = sock.mr == SnMR::IPRAW ? SnSR::IPRAW : SnSR::CLOSED;
+            sock.rxRd = sock.rxWr = sock.txRd = sock.txWr = 0;
+        }
+        else if (cmd == Sock_CLOSE)
+        {
+            sock.sr = SnSR::CLOSED;
+        }
+        else if (cmd == Sock_SEND && sock.sr == SnSR::IPRAW)
+        {
+            std::vector<uint8_t> icmp;
+            for (uint16_t i = sock.txRd; i != sock.txWr; ++i)
+                icmp.push_back(sock.tx[i & SMASK]);
+            sock.txRd = sock.txWr;
+            sock.ir |= SnIR::SEND_OK;
+            transmit(s, icmp);
+        }
+    }
+
+    uint16_t getRXReceivedSize(SOCKET s)
+    {
+        // the Ethernet library reads it twice, to be sure it's settled.
+        Socket& sock = enter(s, 4, 4);
+        return sock.rxWr - sock.rxRd;
+    }
+
+    void read_data(SOCKET s, uint16_t src, uint8_t * dst, uint16_t len)
+    {
+        Socket& sock = enter(s, len, 1);
+        for (uint16_t i = 0; i < len; ++i)
+            dst[i] = sock.rx[(uint16_t)(src + i) & SMASK];
+    }
+
+    void send_data_processing(SOCKET s, const uint8_t * data, uint16_t len)
+    {
+        // TX_WR is read, the data written, and TX_WR written back.
+        Socket& sock = enter(s, 4 + len, 5);
+        for (uint16_t i = 0; i < len; ++i)
+            sock.tx[(uint16_t)(sock.txWr + i) & SMASK] = data[i];
+        sock.txWr += len;
+    }
+
+    uint8_t readIMR() { enter(0, 1, 1); return _imr; }
+    void writeIMR(uint8_t imr) { enter(0, 1, 1); _imr = imr; }
+
+    uint8_t readSnIR(SOCKET s) { return enter(s, 1, 1).ir; }
+    void writeSnIR(SOCKET s, uint8_t bits) { enter(s, 1, 1).ir &= ~bits; }
+    uint8_t readSnSR(SOCKET s) { return enter(s, 1, 1).sr; }
+    void writeSnMR(SOCKET s, uint8_t mr) { enter(s, 1, 1).mr = mr; }
+    void writeSnPROTO(SOCKET s, uint8_t proto) { enter(s, 1, 1).proto = proto; }
+    void writeSnPORT(SOCKET s, uint16_t) { enter(s, 2, 2); }
+    void writeSnDPORT(SOCKET s, uint16_t) { enter(s, 2, 2); }
+    void writeSnDIPR(SOCKET s, uint8_t * addr) { memcpy(enter(s, 4, 1).dip, addr, 4); }
+    void writeSnTTL(SOCKET s, uint8_t ttl) { enter(s, 1, 1).ttl = ttl; }
+    uint8_t readSnTTL(SOCKET s) { return enter(s, 1, 1).rxTtl; }
+    uint16_t readSnRX_RD(SOCKET s) { return enter(s, 2, 2).rxRd; }
+    void writeSnRX_RD(SOCKET s, uint16_t ptr) { enter(s, 2, 2).rxRd = ptr; }
+    uint16_t readSnTX_WR(SOCKET s) { return enter(s, 2, 2).txWr; }
+    void writeSnTX_WR(SOCKET s, uint16_t ptr) { enter(s, 2, 2).txWr = ptr; }
+
+    // the W5500's SPI bus, for the frames the library makes itself: select
+    // the chip, send two address bytes and a control byte, then move data
+    // to or from consecutive addresses until it's deselected. Only the
+    // socket buffers and SIMR are there; the socket registers written this
+    // way (the buffer sizes) are ignored.
+    void select(bool selected)
+    {
+        if (selected)
+            _spiCount = 0;
+        else
+            enter(0, _spiCount > 3 ? _spiCount - 3 : 0, 1);
+    }
+
+    uint8_t transfer(uint8_t data)
+    {
+        uint16_t n = _spiCount++;
+        if (n < 2)
+        {
+            _spiAddr = _spiAddr << 8 | data;
+            return 0;
+        }
+        if (n == 2)
+        {
+            _spiControl = data;
+            return 0;
+        }
+
+        uint16_t addr = _spiAddr + n - 3;
+        uint8_t block = _spiControl >> 3;
+        bool write = _spiControl & 0x04;
+        if (block == 0)
+        {
+            if (addr == 0x0018 && write)
+                _imr = data;
+            return addr == 0x0018 ? _imr : 0;
+        }
+        // each socket has 4 blocks: registers, TX buffer, RX buffer, unused.
+        Socket& sock = _sockets[((block - 1) >> 2) % MAX_SOCK_NUM];
+        switch ((block - 1) & 3)
+        {
+        case 1:
+            if (write)
+                sock.tx[addr & SMASK] = data;
+            return 0;
+        case 2:
+            return sock.rx[addr & SMASK];
+        }
+        return 0;
+    }
+
+private:
+    struct Socket
+    {
+        uint8_t mr, sr, ir, proto, ttl, rxTtl;
+        uint8_t dip[4];
+        uint16_t rxRd, rxWr, txRd, txWr;
+        uint8_t rx[SSIZE];
+        uint8_t tx[SSIZE];
+    };
+
+    // a datagram on its way to us, as it will appear in the RX buffer.
+    struct Arrival
+    {
+        uint32_t due; // in us
+        SOCKET s;
+        uint8_t ttl;
+        std::vector<uint8_t> data;
+    };
+
+    // the start of every call, which moves numBytes of data in numFrames
+    // W5500 frames: count the frames, see how deep the stack is, and
+    // deliver anything that's arrived by now. Every W5100 frame is 4 bytes
+    // with one of data; a W5500 frame is 3 bytes and the data.
+    Socket& enter(SOCKET s, uint16_t numBytes, uint16_t numFrames)
+    {
+        uint8_t here;
+        if ((uintptr_t)&here < stackLow)
+            stackLow = (uintptr_t)&here;
+#ifdef ICMPPING_W5500
+        frames += numFrames;
+        wait((3UL * numFrames + numBytes) * frameTime / 4);
+#else
+        (void)numFrames;
+        frames += numBytes;
+        wait((uint32_t)numBytes * frameTime);
+#endif
+        return _sockets[s];
+    }
+
+    uint32_t random(uint32_t n)
+    {
+        // xorshift, so that runs can be repeated.
+        _seed ^= _seed << 13;
+        _seed ^= _seed >> 17;
+        _seed ^= _seed << 5;
+        return n ? _seed % n : 0;
+    }
+
+    static uint16_t checksum(const uint8_t * data, uint16_t len)
+    {
+        uint32_t sum = 0;
+        for (uint16_t i = 0; i + 1 < len; i += 2)
+            sum += (uint16_t)(data[i] << 8 | data[i + 1]);
+        if (len & 1)
+            sum += (uint16_t)(data[len - 1] << 8);
+        while (sum >> 16)
+            sum = (sum & 0xFFFF) + (sum >> 16);
+        return ~sum;
+    }
+
+    static void setChecksum(std::vector<uint8_t>& icmp)
+    {
+        icmp[2] = icmp[3] = 0;
+        uint16_t sum = checksum(icmp.data(), icmp.size());
+        icmp[2] = sum >> 8;
+        icmp[3] = sum & 0xFF;
+    }
+
+    // what happens to an ICMP message once it leaves socket s.
+    void transmit(SOCKET s, const std::vector<uint8_t>& request)
+    {
+        Socket& sock = _sockets[s];
+        IPAddress dest(sock.dip);
+        if (request.size() < 8 || request[0] != 8 || random(100) < loss)
+            return;
+
+        uint8_t from[4];
+        std::vector<uint8_t> icmp;
+        uint32_t travel = (latency + random(jitter + 1)) * 1000UL;
+        uint8_t ttl;
+        if (sock.ttl <= hops)
+        {
+            // the quoted IP header, then the first 8 bytes of the request.
+            const uint8_t ip[20] = {0x45, 0, 0, 28, 0, 0, 0, 0, 1, 1, 0, 0,
+                                    192, 168, 2, 177, dest[0], dest[1], dest[2], dest[3]};
+            icmp.assign(8, 0);
+            icmp[0] = 11;
+            icmp.insert(icmp.end(), ip, ip + sizeof(ip));
+            icmp.insert(icmp.end(), request.begin(), request.begin() + 8);
+            IPAddress hop = router(sock.ttl);
+            for (uint8_t i = 0; i < 4; ++i)
+                from[i] = hop[i];
+            travel = travel / (hops + 1) * sock.ttl;
+            ttl = 64 - sock.ttl + 1;
+        }
+        else
+        {
+            if (answers && !answers(dest))
+                return;
+            icmp = request;
+            icmp[0] = 0;
+            memcpy(from, sock.dip, 4);
+            ttl = 64 - hops;
+        }
+        setChecksum(icmp);
+
+        Arrival arrival;
+        arrival.due = _now + travel;
+        arrival.s = s;
+        arrival.ttl = ttl;
+        arrival.data.assign(from, from + 4);
+        arrival.data.push_back(icmp.size() >> 8);
+        arrival.data.push_back(icmp.size() & 0xFF);
+        arrival.data.insert(arrival.data.end(), icmp.begin(), icmp.end());
+        _inFlight.push_back(arrival);
+    }
+
+    void deliver()
+    {
+        for (std::deque<Arrival>::iterator it = _inFlight.begin(); it != _inFlight.end();)
+        {
+            if ((int32_t)(_now - it->due) < 0)
+            {
+                ++it;
+                continue;
+            }
+            Socket& sock = _sockets[it->s];
+            // like the real chip, drop it if there's no room.
+            if (sock.sr == SnSR::IPRAW && (size_t)(SSIZE - (uint16_t)(sock.rxWr - sock.rxRd)) >= it->data.size())
+            {
+                for (uint16_t i = 0; i < it->data.size(); ++i)
+                    sock.rx[(uint16_t)(sock.rxWr + i) & SMASK] = it->data[i];
+                sock.rxWr += it->data.size();
+                sock.rxTtl = it->ttl;
+                sock.ir |= SnIR::RECV;
+            }
+            it = _inFlight.erase(it);
+        }
+    }
+
+    Socket _sockets[MAX_SOCK_NUM];
+    std::deque<Arrival> _inFlight;
+    uint32_t _now;
+    uint8_t _imr;
+    uint16_t _spiCount;
+    uint16_t _spiAddr;
+    uint8_t _spiControl;
+    uint32_t _seed;
+};
+
+inline W5100Sim W5100;
+
+inline uint32_t micros()
+{
+    return W5100.now();
+}
+
+inline uint32_t millis()
+{
+    return W5100.now() / 1000;
+}
+
+inline void delay(unsigned long ms)
+{
+    W5100.wait(ms * 1000);
+}
+
+#ifdef ICMPPING_W5500
+
+#define LOW 0
+#define HIGH 1
+#define MSBFIRST 1
+#define SPI_MODE0 0
+
+inline W5100Sim& w5500 = W5100;
+
+struct SPISettings
+{
+    SPISettings(uint32_t, uint8_t, uint8_t) {}
+};
+
+class SPIClass
+{
+public:
+    void beginTransaction(SPISettings) {}
+    void endTransaction() {}
+    uint8_t transfer(uint8_t data) { return W5100.transfer(data); }
+};
+
+inline SPIClass SPI;
+
+// the only pin there is is the W5500's chip select.
+inline void digitalWrite(uint8_t, uint8_t level)
+{
+    W5100.select(level == LOW);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,156 @@
+/*
+  Simulator Benchmark
+
+ Runs the library against the simulated W5100 in W5100Sim.h, and reports
+ what pinging costs: pings a second, SPI frames, register accesses and
+ buffer bytes per ping, and the RAM and stack it takes, so that a change
+ that makes any of them worse shows up before it's flashed anywhere. Build
+ it from the icmp_ping directory:
+
+    g++ -O2 -std=c++17 -DICMPPING_PLATFORM_HEADER='"extras/sim/W5100Sim.h"' \
+        -DICMPPING_PROFILE_ENABLE -I . *.cpp extras/sim/bench.cpp -o simbench
+
+ and give it the network to simulate:
+
+    ./simbench [latency [jitter [loss [hops]]]]
+
+ e.g. ./simbench 20 40 10 5 for a round trip of 20 to 60ms, with 10% of
+ requests lost and 5 routers on the way. Half of the hosts in the sweep are
+ down. The register and byte counts need ICMPPING_PROFILE_ENABLE. Add
+ -DICMPPING_W5500 to simulate a W5500 instead, whose SPI frames can carry a
+ whole packet.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ICMPPing.h>
+#include <ICMPMultiPing.h>
+#include <ICMPTraceroute.h>
+
+#define PINGS 200
+#define HOSTS 1000
+#define MAX_HOPS 30
+
+SOCKET pingSocket = 0;
+uint16_t pingId = 42;
+
+// where main()'s stack starts, to measure how deep it gets from.
+uintptr_t stackTop;
+
+bool oddHostsUp(const IPAddress& addr)
+{
+  return addr[3] & 1;
+}
+
+void ignore(uint16_t, const ICMPEchoReply&, void *)
+{
+}
+
+void start()
+{
+  W5100.reset();
+#ifdef ICMPPING_PROFILE_ENABLE
+  ICMPPing::resetProfile();
+#endif
+}
+
+void report(const char * name, uint32_t pings, uint32_t received, uint32_t started)
+{
+  uint32_t elapsed = millis() - started;
+  printf("%-10s %5lu/%-5lu %8.0f pings/s %6.1f frames/ping", name,
+         (unsigned long)received, (unsigned long)pings,
+         elapsed ? pings * 1000.0 / elapsed : 0.0,
+         (double)W5100.frames / pings);
+#ifdef ICMPPING_PROFILE_ENABLE
+  ICMPPingProfile profile = ICMPPing::profile();
+  printf(" %5.1f reads %5.1f writes %5.1f bytes in %5.1f out",
+         (double)profile.registerReads / pings,
+         (double)profile.registerWrites / pings,
+         (double)profile.bytesRead / pings,
+         (double)profile.bytesWritten / pings);
+#endif
+  printf(" %5lu bytes of stack\n", (unsigned long)(stackTop - W5100.stackLow));
+}
+
+void single(bool session)
+{
+  ICMPPing ping(pingSocket, pingId);
+  if (session)
+    ping.begin();
+  start();
+  uint32_t started = millis();
+  uint32_t received = 0;
+  for (uint16_t i = 0; i < PINGS; ++i)
+  {
+    received += ping(IPAddress(192, 168, 1, 1), 1).status == SUCCESS;
+  }
+  report(session ? "session" : "single", PINGS, received, started);
+  if (session)
+    ping.end();
+}
+
+void sweep()
+{
+  static IPAddress addrs[HOSTS];
+  for (uint16_t i = 0; i < HOSTS; ++i)
+    addrs[i] = IPAddress(192, 168, 1 + i / 250, 1 + i % 250);
+
+  W5100.answers = oddHostsUp;
+  ICMPPingPool pool(pingSocket, pingId);
+  start();
+  uint32_t started = millis();
+  uint16_t up = pool(addrs, HOSTS, 1, ignore, NULL);
+  report("sweep", HOSTS, up, started);
+  W5100.answers = NULL;
+}
+
+void trace()
+{
+  ICMPTracerouteT<0> traceroute(pingSocket, pingId);
+  ICMPTracerouteHop hops[MAX_HOPS];
+  start();
+  uint32_t started = millis();
+  uint8_t numHops = traceroute(IPAddress(192, 168, 1, 1), hops, MAX_HOPS);
+  uint8_t answered = 0;
+  for (uint8_t i = 0; i < (numHops ? numHops : MAX_HOPS); ++i)
+    answered += hops[i].status == SUCCESS;
+  report("traceroute", W5100.hops + 1, answered, started);
+}
+
+int main(int argc, char ** argv)
+{
+  uint8_t top;
+  stackTop = (uintptr_t)&top;
+
+  if (argc > 1)
+    W5100.latency = atoi(argv[1]);
+  if (argc > 2)
+    W5100.jitter = atoi(argv[2]);
+  if (argc > 3)
+    W5100.loss = atoi(argv[3]);
+  if (argc > 4)
+    W5100.hops = atoi(argv[4]);
+  if (argc > 5 || W5100.hops >= MAX_HOPS)
+  {
+    fprintf(stderr, "usage: %s [latency [jitter [loss [hops]]]]\n", argv[0]);
+    return 2;
+  }
+#ifdef ICMPPING_W5500
+  printf("W5500, ");
+#else
+  printf("W5100, ");
+#endif
+  printf("%dms latency, %dms jitter, %d%% loss, %d hops\n",
+         W5100.latency, W5100.jitter, W5100.loss, W5100.hops);
+
+  single(false);
+  single(true);
+  sweep();
+  trace();
+
+  printf("RAM: ICMPPing %d, ICMPEchoReply %d, ICMPPingPool %d, ICMPPingScheduler %d, ICMPTraceroute %d bytes\n",
+         (int)sizeof(ICMPPing), (int)sizeof(ICMPEchoReply), (int)sizeof(ICMPPingPool),
+         (int)sizeof(ICMPPingScheduler), (int)sizeof(ICMPTracerouteT<0>));
+  return 0;
+}
@@ -0,0 +1,140 @@
+/*
+  Reply Parser Fuzzer
+
+ A libFuzzer target for the code that reads replies out of the RX buffer.
+ Each input goes into the simulated W5100's RX buffer as it is, source
+ addresses, lengths and all, and is read back out the way a ping would,
+ so a hostile or garbled packet that gets it to read out of bounds, or
+ lose its place in the buffer for good, shows up. Build it from the
+ icmp_ping directory with clang:
+
+    clang++ -g -O1 -std=c++17 -fsanitize=fuzzer,address,undefined \
+        -DICMPPING_PLATFORM_HEADER='"extras/sim/W5100Sim.h"' \
+        -I . *.cpp extras/sim/fuzz.cpp -o fuzz
+    ./fuzz
+
+ or without libFuzzer, by defining ICMPPING_FUZZ_MAIN, to run some inputs
+ made up at random, or the files given on the command line:
+
+    g++ -g -O1 -std=c++17 -fsanitize=address,undefined -DICMPPING_FUZZ_MAIN \
+        -DICMPPING_PLATFORM_HEADER='"extras/sim/W5100Sim.h"' \
+        -I . *.cpp extras/sim/fuzz.cpp -o fuzz
+    ./fuzz [file...]
+
+ The first byte of each input moves the buffer pointers along before the
+ rest goes in, so that packets wrap around the end of the buffer too.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ICMPPing.h>
+
+#define ID 42
+
+// readEchoReply() is only meant for the library's own classes.
+class ReplyReader : public ICMPPing
+{
+public:
+  using ICMPPing::readEchoReply;
+};
+
+template <uint16_t PayloadSize>
+void readAll(SOCKET s)
+{
+  ICMPEchoReplyT<PayloadSize> echoReply;
+  uint16_t seq;
+  IPAddress addr;
+  // each read takes at least a 6 byte datagram header out of the buffer.
+  for (uint16_t reads = 0; ReplyReader::readEchoReply(s, ID, echoReply, seq, addr); ++reads)
+  {
+    if (reads > W5100Sim::SSIZE / 6)
+      abort();
+  }
+  if (ICMPPingChip::rxSize(s) != 0)
+    abort();
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size)
+{
+  if (size < 1 || size > 1 + W5100Sim::SSIZE)
+    return 0;
+
+  SOCKET s = data[0] & 1;
+  ICMPPingChip::openSocket(s);
+  uint16_t skip = data[0] * 8;
+  uint8_t junk[255 * 8] = {0};
+  W5100.receive(s, junk, skip);
+  ICMPPingChip::release(s, ICMPPingChip::rxPointer(s) + skip);
+
+  W5100.receive(s, data + 1, size - 1);
+  if (s == 0)
+    readAll<REQ_DATASIZE>(s);
+  else
+    readAll<0>(s);
+  return 0;
+}
+
+#ifdef ICMPPING_FUZZ_MAIN
+
+#define RUNS 100000
+
+// an echo reply or TIME_EXCEEDED for one of our requests, with a header in
+// front of it as the W5100 writes it, and then some damage.
+size_t makeInput(uint8_t * input)
+{
+  static const uint8_t reply[] = {
+    0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, ID, 0, 1, 0, 0, 0, 0};
+  static const uint8_t exceeded[] = {
+    0, 0, 0, 0, 0, 0,
+    11, 0, 0, 0, 0, 0, 0, 0,
+    0x45, 0, 0, 28, 0, 0, 0, 0, 1, 1, 0, 0, 192, 168, 2, 177, 192, 168, 1, 1,
+    8, 0, 0, 0, 0, ID, 0, 1};
+
+  input[0] = rand();
+  const uint8_t * packet = rand() & 1 ? reply : exceeded;
+  size_t size = packet == reply ? sizeof(reply) : sizeof(exceeded);
+  memcpy(input + 1, packet, size);
+  // a payload, sometimes.
+  if (packet == reply)
+  {
+    uint16_t payload = rand() % (REQ_DATASIZE + 8);
+    memset(input + 1 + size, 0x1A, payload);
+    size += payload;
+  }
+  input[5] = (size - 6) >> 8;
+  input[6] = (size - 6) & 0xFF;
+  for (uint8_t i = rand() % 4; i > 0; --i)
+    input[1 + rand() % size] = rand();
+  return 1 + size;
+}
+
+int main(int argc, char ** argv)
+{
+  static uint8_t input[1 + W5100Sim::SSIZE];
+  if (argc > 1)
+  {
+    for (int i = 1; i < argc; ++i)
+    {
+      FILE * file = fopen(argv[i], "rb");
+      if (!file)
+      {
+        perror(argv[i]);
+        return 1;
+      }
+      size_t size = fread(input, 1, sizeof(input), file);
+      fclose(file);
+      LLVMFuzzerTestOneInput(input, size);
+    }
+    return 0;
+  }
+
+  srand(1);
+  for (uint32_t run = 0; run < RUNS; ++run)
+    LLVMFuzzerTestOneInput(input, makeInput(input));
+  printf("%d inputs\n", RUNS);
+  return 0;
+}
+
+#endif